@@ -6,6 +6,9 @@
 #include <iostream>
 #include <chrono>
 #include <vector>
+#include <atomic>
+#include <new>
+#include <cstdlib>
 #include "../TestBinStream/SimpleBinStream.h"
 #include "OldSimpleBinStream.h"
 
@@ -24,6 +27,92 @@ static void do_not_optimize_away(const char* p) {
 }
 #endif
 
+// Build with -DBENCHMARK_COUNT_ALLOCATIONS to count the heap allocations and
+// show where they disappear. The counting replaces the global operator new,
+// which slows down every other timing, so it is off by default.
+#ifdef BENCHMARK_COUNT_ALLOCATIONS
+static std::atomic<size_t> alloc_count(0);
+
+void* operator new(std::size_t size)
+{
+	++alloc_count;
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+#ifdef __GNUC__
+// kept out of line, or GCC sees free() on memory from operator new and warns
+__attribute__((noinline))
+#endif
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+void operator delete[](void* p) noexcept
+{
+	operator delete(p);
+}
+void operator delete(void* p, std::size_t) noexcept
+{
+	operator delete(p);
+}
+void operator delete[](void* p, std::size_t) noexcept
+{
+	operator delete(p);
+}
+#ifdef __cpp_aligned_new
+void* operator new(std::size_t size, std::align_val_t align)
+{
+	++alloc_count;
+	size_t al = static_cast<size_t>(align);
+#ifdef _MSC_VER
+	if (void* p = _aligned_malloc(size ? size : 1, al))
+		return p;
+#else
+	// aligned_alloc wants a multiple of the alignment
+	if (void* p = std::aligned_alloc(al, size ? (size + al - 1) / al * al : al))
+		return p;
+#endif
+	throw std::bad_alloc();
+}
+void operator delete(void* p, std::align_val_t) noexcept
+{
+#ifdef _MSC_VER
+	_aligned_free(p);
+#else
+	std::free(p);
+#endif
+}
+void operator delete(void* p, std::size_t, std::align_val_t align) noexcept
+{
+	operator delete(p, align);
+}
+#endif
+#endif // BENCHMARK_COUNT_ALLOCATIONS
+
+static size_t allocations()
+{
+#ifdef BENCHMARK_COUNT_ALLOCATIONS
+	return alloc_count;
+#else
+	return 0;
+#endif
+}
+
+// prints the allocations made since allocations() returned allocs
+static void print_allocations(size_t allocs)
+{
+#ifdef BENCHMARK_COUNT_ALLOCATIONS
+	std::cout << std::setw(30) << "allocations" << ":" << std::setw(8) << (alloc_count - allocs) << std::endl;
+#else
+	(void)allocs;
+#endif
+}
+
 class timer
 {
 public:
@@ -53,8 +142,27 @@ struct Product
 	std::string name;
 	int qty;
 	float price;
+
+	SIMPLE_BINSTREAM_FIELDS(name, qty, price)
 };
 
+#ifdef SIMPLE_BINSTREAM_PMR
+// Product whose name is allocated from the memory_resource of its container
+struct PmrProduct
+{
+	typedef std::pmr::polymorphic_allocator<char> allocator_type;
+
+	explicit PmrProduct(const allocator_type& alloc = allocator_type()) : name(alloc), qty(0), price(0.0f) {}
+	PmrProduct(const PmrProduct& other, const allocator_type& alloc) : name(other.name, alloc), qty(other.qty), price(other.price) {}
+	PmrProduct(PmrProduct&& other, const allocator_type& alloc) : name(std::move(other.name), alloc), qty(other.qty), price(other.price) {}
+	std::pmr::string name;
+	int qty;
+	float price;
+
+	SIMPLE_BINSTREAM_FIELDS(name, qty, price)
+};
+#endif
+
 void init(std::vector<Product>& vec);
 
 int main(int argc, char *argv[])
@@ -62,6 +170,7 @@ int main(int argc, char *argv[])
 	const std::string old_file = "F:\\old_products.txt";
 	const std::string new_file = "F:\\new_products.txt";
 	const std::string mem_file = "F:\\mem_products.txt";
+	const std::string uring_file = "F:\\uring_products.txt";
 
 	const size_t MAX_LOOP = (argc == 2) ? atoi(argv[1]) : 100000;
 
@@ -156,10 +265,181 @@ int main(int argc, char *argv[])
 				fprintf(stderr, "%s\n", e.what());
 			}
 			stopwatch.stop();
+
+			// partial-field scan: only qty is decoded
+			is.seekg(0);
+			int total_qty = 0;
+			stopwatch.start("new::file_istream skip");
+			try
+			{
+				while (!is.eof())
+				{
+					is.skip_string();
+					is >> product.qty;
+					is.skip<float>();
+					total_qty += product.qty;
+				}
+			}
+			catch (std::runtime_error& e)
+			{
+				fprintf(stderr, "%s\n", e.what());
+			}
+			stopwatch.stop();
+			do_not_optimize_away(reinterpret_cast<const char*>(&total_qty));
+		}
+
+		is.close();
+	}
+	{
+		using namespace simple;
+
+		// whole scans with the file in the page cache, and after dropping it
+		auto scan = [&](const char* name, unsigned hints) {
+			file_istream<std::true_type> is(new_file.c_str(), hints);
+			Product product;
+			stopwatch.start(name);
+			try
+			{
+				while (!is.eof())
+					is >> product.name >> product.qty >> product.price;
+			}
+			catch (std::runtime_error& e)
+			{
+				fprintf(stderr, "%s\n", e.what());
+			}
+			stopwatch.stop();
+		};
+		auto load = [&](const char* name, unsigned hints) {
+			stopwatch.start(name);
+			memfile_istream<std::true_type> is(new_file.c_str(), hints);
+			do_not_optimize_away(reinterpret_cast<const char*>(&is));
+			stopwatch.stop();
+		};
+		auto prefetch = [&](const char* name, unsigned hints) {
+			prefetch_istream<std::true_type> is(new_file.c_str(), 1 << 20, 4, hints);
+			Product product;
+			stopwatch.start(name);
+			try
+			{
+				while (!is.eof())
+					is >> product.name >> product.qty >> product.price;
+			}
+			catch (std::runtime_error& e)
+			{
+				fprintf(stderr, "%s\n", e.what());
+			}
+			stopwatch.stop();
+		};
+		auto drop_cache = [&]() {
+			file_istream<std::true_type> is(new_file.c_str(), hint_dontneed);
+		};
+
+		scan("file_istream warm", hint_none);
+		drop_cache();
+		scan("file_istream cold", hint_none);
+		drop_cache();
+		scan("file_istream cold, hinted", hint_sequential | hint_willneed);
+		prefetch("prefetch_istream warm", hint_none);
+		drop_cache();
+		prefetch("prefetch_istream cold", hint_none);
+		load("memfile_istream warm", hint_none);
+		drop_cache();
+		load("memfile_istream cold", hint_none);
+		drop_cache();
+		load("memfile_istream cold, hinted", hint_sequential | hint_willneed);
+	}
+	{
+		using namespace simple;
+
+		file_ostream<std::true_type> os(new_file.c_str());
+
+		if (os.is_open())
+		{
+			stopwatch.start("new::file_ostream write_all");
+			for (size_t k = 0; k < MAX_LOOP; ++k)
+			{
+				for (size_t i = 0; i < vec.size(); ++i)
+				{
+					const Product& product = vec[i];
+					write_all(os, product.name, product.qty, product.price);
+					do_not_optimize_away(result.c_str());
+				}
+			}
+			stopwatch.stop();
+		}
+		os.flush();
+		os.close();
+	}
+#ifdef SIMPLE_BINSTREAM_POSIX
+	{
+		using namespace simple;
+
+		uring_file_ostream<std::true_type> os(uring_file.c_str());
+
+		if (os.is_open())
+		{
+			stopwatch.start("new::uring_file_ostream");
+			for (size_t k = 0; k < MAX_LOOP; ++k)
+			{
+				for (size_t i = 0; i < vec.size(); ++i)
+				{
+					const Product& product = vec[i];
+					os << product.name << product.qty << product.price;
+					do_not_optimize_away(result.c_str());
+				}
+			}
+			// writes are in flight until flushed, so count the wait for them
+			os.flush();
+			stopwatch.stop();
+		}
+		os.close();
+
+		uring_file_istream<std::true_type> is(uring_file.c_str());
+
+		if (is.is_open())
+		{
+			Product product;
+			stopwatch.start("new::uring_file_istream");
+			try
+			{
+				while (!is.eof())
+				{
+					is >> product.name >> product.qty >> product.price;
+				}
+			}
+			catch (std::runtime_error& e)
+			{
+				fprintf(stderr, "%s\n", e.what());
+			}
+			stopwatch.stop();
 		}
 
 		is.close();
+
+		// the same file again, bypassing the page cache
+		uring_file_istream<std::true_type> direct(uring_file.c_str(), 1 << 20, 4, hint_direct);
+
+		if (direct.is_open())
+		{
+			Product product;
+			stopwatch.start(direct.is_direct() ? "new::uring_file_istream direct" : "new::uring_file_istream direct (fallback)");
+			try
+			{
+				while (!direct.eof())
+				{
+					direct >> product.name >> product.qty >> product.price;
+				}
+			}
+			catch (std::runtime_error& e)
+			{
+				fprintf(stderr, "%s\n", e.what());
+			}
+			stopwatch.stop();
+		}
+
+		direct.close();
 	}
+#endif
 	{
 		using namespace simple;
 
@@ -217,6 +497,91 @@ int main(int argc, char *argv[])
 		}
 		stopwatch.stop();
 
+		rope_ostream<std::true_type> os_rope;
+
+		stopwatch.start("new::rope_ostream");
+		for (size_t k = 0; k < MAX_LOOP; ++k)
+		{
+			for (size_t i = 0; i < vec.size(); ++i)
+			{
+				const Product& product = vec[i];
+				os_rope << product.name << product.qty << product.price;
+				do_not_optimize_away(result.c_str());
+			}
+		}
+		stopwatch.stop();
+
+		mem_ostream<std::true_type> os_all;
+
+		stopwatch.start("new::mem_ostream write_all");
+		for (size_t k = 0; k < MAX_LOOP; ++k)
+		{
+			for (size_t i = 0; i < vec.size(); ++i)
+			{
+				const Product& product = vec[i];
+				write_all(os_all, product.name, product.qty, product.price);
+				do_not_optimize_away(result.c_str());
+			}
+		}
+		stopwatch.stop();
+
+		// one message at a time, as for a packet
+		stopwatch.start("mem_ostream per message");
+		for (size_t k = 0; k < MAX_LOOP; ++k)
+		{
+			for (size_t i = 0; i < vec.size(); ++i)
+			{
+				const Product& product = vec[i];
+				mem_ostream<std::true_type> msg;
+				msg << product.name << product.qty << product.price;
+				do_not_optimize_away(msg.data());
+			}
+		}
+		stopwatch.stop();
+
+		stopwatch.start("ptr_ostream per message");
+		for (size_t k = 0; k < MAX_LOOP; ++k)
+		{
+			for (size_t i = 0; i < vec.size(); ++i)
+			{
+				const Product& product = vec[i];
+				char buf[128];
+				ptr_ostream<std::true_type> msg(buf, sizeof(buf));
+				msg << product.name << product.qty << product.price;
+				do_not_optimize_away(msg.data());
+			}
+		}
+		stopwatch.stop();
+
+		// tiny control messages: type, id and value
+		size_t allocs = allocations();
+		stopwatch.start("mem_ostream tiny message");
+		for (size_t k = 0; k < MAX_LOOP; ++k)
+		{
+			for (size_t i = 0; i < vec.size(); ++i)
+			{
+				mem_ostream<std::true_type> msg;
+				msg << 7 << (int64_t)i << vec[i].price;
+				do_not_optimize_away(msg.data());
+			}
+		}
+		stopwatch.stop();
+		print_allocations(allocs);
+
+		allocs = allocations();
+		stopwatch.start("small_mem_ostream tiny message");
+		for (size_t k = 0; k < MAX_LOOP; ++k)
+		{
+			for (size_t i = 0; i < vec.size(); ++i)
+			{
+				small_mem_ostream<std::true_type> msg;
+				msg << 7 << (int64_t)i << vec[i].price;
+				do_not_optimize_away(msg.data());
+			}
+		}
+		stopwatch.stop();
+		print_allocations(allocs);
+
 		mem_istream<std::true_type> is(os.get_internal_vec());
 
 		Product product;
@@ -249,7 +614,122 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "%s\n", e.what());
 		}
 		stopwatch.stop();
+
+		// partial-field scan: only qty is decoded
+		ptr_is.seekg(0);
+		int total_qty = 0;
+		stopwatch.start("new::ptr_istream skip");
+		try
+		{
+			while (!ptr_is.eof())
+			{
+				ptr_is.skip_string();
+				ptr_is >> product.qty;
+				ptr_is.skip<float>();
+				total_qty += product.qty;
+			}
+		}
+		catch (std::runtime_error& e)
+		{
+			fprintf(stderr, "%s\n", e.what());
+		}
+		stopwatch.stop();
+		do_not_optimize_away(reinterpret_cast<const char*>(&total_qty));
 	}
+	{
+		using namespace simple;
+
+		// fixed-layout records: qty, price, id
+		mem_ostream<std::true_type> os;
+		for (size_t k = 0; k < MAX_LOOP; ++k)
+		{
+			for (size_t i = 0; i < vec.size(); ++i)
+				write_all(os, vec[i].qty, vec[i].price, (int64_t)k);
+		}
+		const size_t record_size = sizeof(int) + sizeof(float) + sizeof(int64_t);
+		std::vector<char> padded(os.get_internal_vec());
+		padded.resize(padded.size() + record_size);
+
+		int qty = 0;
+		float price = 0.0f;
+		int64_t id = 0, total = 0;
+		ptr_istream<std::true_type> is(os.get_internal_vec());
+		stopwatch.start("ptr_istream checked reads");
+		while (!is.eof())
+		{
+			is >> qty >> price >> id;
+			total += qty + id;
+		}
+		stopwatch.stop();
+
+		is.seekg(0);
+		stopwatch.start("ptr_istream ensure window");
+		while (!is.eof())
+		{
+			is.ensure(record_size);
+			is.read_unchecked(qty);
+			is.read_unchecked(price);
+			is.read_unchecked(id);
+			total += qty + id;
+		}
+		stopwatch.stop();
+
+		ptr_istream<std::true_type> padded_is(padded.data(), os.size(), record_size);
+		stopwatch.start("ptr_istream padded");
+		while (!padded_is.eof())
+		{
+			padded_is.read_unchecked(qty);
+			padded_is.read_unchecked(price);
+			padded_is.read_unchecked(id);
+			total += qty + id;
+		}
+		padded_is.check();
+		stopwatch.stop();
+		do_not_optimize_away(reinterpret_cast<const char*>(&total));
+	}
+#ifdef SIMPLE_BINSTREAM_PMR
+	{
+		using namespace simple;
+
+		// long names, so that each one needs its own allocation
+		std::vector<Product> records;
+		records.reserve(MAX_LOOP * vec.size());
+		for (size_t k = 0; k < MAX_LOOP; ++k)
+		{
+			for (size_t i = 0; i < vec.size(); ++i)
+				records.push_back(Product(vec[i].name + " / imported goods", vec[i].qty, vec[i].price));
+		}
+		mem_ostream<std::true_type> os;
+		os << records;
+		std::vector<Product>().swap(records);
+
+		{
+			ptr_istream<std::true_type> is(os.get_internal_vec());
+			size_t allocs = allocations();
+			stopwatch.start("std::vector<Product>");
+			{
+				std::vector<Product> loaded;
+				is >> loaded;
+				do_not_optimize_away(loaded.back().name.c_str());
+			}
+			stopwatch.stop();
+			print_allocations(allocs);
+		}
+		{
+			ptr_istream<std::true_type> is(os.get_internal_vec());
+			size_t allocs = allocations();
+			stopwatch.start("std::pmr::vector<PmrProduct>");
+			{
+				std::pmr::monotonic_buffer_resource arena;
+				std::pmr::vector<PmrProduct> loaded(&arena);
+				is >> loaded;
+				do_not_optimize_away(loaded.back().name.c_str());
+			}
+			stopwatch.stop();
+			print_allocations(allocs);
+		}
+	}
+#endif
 
 	return 0;
 }
@@ -1,5 +1,5 @@
 // The MIT License (MIT)
-// Simplistic Binary Streams 1.0.3
+// Simplistic Binary Streams 1.2.9
 // Copyright (C) 2014 - 2019, by Wong Shao Voon (shaovoon@yahoo.com)
 //
 // http://opensource.org/licenses/MIT
@@ -19,6 +19,34 @@
 //                   wide char type.(only available on win32)
 // version 1.0.3   : Remove <iostream> header
 // version 1.0.4   : Fixed file_istream's seekg() and added writeat() to mem_ostream and memfile_ostream. Thanks Festering from CodeProject.
+// version 1.0.5   : Add chunk_istream for resumable decoding of data that arrives in chunks
+// version 1.0.6   : Add C++20 coroutine async_file_istream and async_file_ostream with
+//                   io_uring and thread pool backends
+// version 1.0.7   : Add uring_file_ostream and uring_file_istream which keep several blocks in flight
+// version 1.0.8   : Add async flushing on a background thread to file_ostream and memfile_ostream,
+//                   flush() and close() of file_ostream return a future
+// version 1.0.9   : Add SIMPLE_BINSTREAM_FIELDS for automatic serialization of structs with all
+//                   streams, block copy of trivially copyable structs and arrays of them
+// version 1.1.0   : Add operators for the standard containers, pair, tuple, optional and variant
+// version 1.1.1   : Add columnar batches with column projection on read, skip() on the istreams
+// version 1.1.2   : Add skip<T>(), skip_string() and peek<T>() to the istreams
+// version 1.1.3   : Strings and containers are read through their own allocator, e.g. std::pmr
+// version 1.1.4   : Add Allocator parameter to mem_ostream, memfile_ostream and mem_istream
+// version 1.1.5   : Add mem_ostream_pool which presizes buffers from a size histogram per message type
+// version 1.1.6   : Add size_ostream and serialized_size to compute the encoded size without encoding
+// version 1.1.7   : Add write_all to write a record in a single write; no temporary vector per value
+// version 1.1.8   : Add ensure() and read_unchecked() to the memory istreams, padded buffers
+// version 1.1.9   : File and memory streams share one istream and one ostream core over source and sink policies
+// version 1.2.0   : Add ptr_ostream which writes into a fixed-size buffer of the caller
+// version 1.2.1   : Add small_mem_ostream with inline storage, span() on the memory ostreams
+// version 1.2.2   : Add rope_ostream over a chain of blocks, flushed with writev
+// version 1.2.3   : Add segmented_istream which reads across several buffers or files
+// version 1.2.4   : Add shared_buffer and shared_istream, cursors and slices over one immutable buffer
+// version 1.2.5   : Add positional_file with thread-safe pread-based read_at(), positional_istream cursors
+// version 1.2.6   : 64-bit file offsets, sizes, tellg() and seekg() in the file streams
+// version 1.2.7   : Add file_hint options for readahead, page cache dropping and steady writeback
+// version 1.2.8   : Add hint_direct, O_DIRECT for uring_file_istream and uring_file_ostream
+// version 1.2.9   : Add prefetch_istream, read-ahead on a background thread over a ring of blocks
 
 #ifndef SimpleBinStream_H
 #define SimpleBinStream_H
@@ -27,9 +55,92 @@
 #include <vector>
 #include <string>
 #include <cstring>
+#include <algorithm>
 #include <stdexcept>
 #include <stdint.h>
 #include <cstdio>
+#include <climits>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <future>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <array>
+#include <list>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+
+#if defined(_MSVC_LANG) && _MSVC_LANG > __cplusplus
+#define SIMPLE_BINSTREAM_CPLUSPLUS _MSVC_LANG
+#else
+#define SIMPLE_BINSTREAM_CPLUSPLUS __cplusplus
+#endif
+
+#if SIMPLE_BINSTREAM_CPLUSPLUS >= 201703L
+#define SIMPLE_BINSTREAM_CPP17 1
+#include <optional>
+#include <variant>
+#if defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define SIMPLE_BINSTREAM_PMR 1
+#endif
+#endif
+#endif
+
+#if SIMPLE_BINSTREAM_CPLUSPLUS >= 202002L && defined(__has_include)
+#if __has_include(<span>)
+#include <span>
+#define SIMPLE_BINSTREAM_SPAN 1
+#endif
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SIMPLE_BINSTREAM_POSIX 1
+#endif
+
+// define SIMPLE_BINSTREAM_NO_IO_URING to always use the thread pool backend
+#if defined(__linux__) && defined(__has_include) && !defined(SIMPLE_BINSTREAM_NO_IO_URING)
+#if __has_include(<linux/io_uring.h>)
+#define SIMPLE_BINSTREAM_IO_URING 1
+#endif
+#endif
+
+// posix_fadvise is missing on macOS
+#if defined(SIMPLE_BINSTREAM_POSIX) && !defined(__APPLE__)
+#define SIMPLE_BINSTREAM_FADVISE 1
+#endif
+
+#if SIMPLE_BINSTREAM_CPLUSPLUS >= 202002L && defined(__cpp_impl_coroutine) && defined(SIMPLE_BINSTREAM_POSIX)
+#define SIMPLE_BINSTREAM_COROUTINE 1
+#endif
+
+#ifdef SIMPLE_BINSTREAM_POSIX
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef SIMPLE_BINSTREAM_COROUTINE
+#include <coroutine>
+#endif
+
+#ifdef SIMPLE_BINSTREAM_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
 
 namespace simple
 {
@@ -158,949 +269,5733 @@ namespace simple
 		// same endian so do nothing.
 	}
 
-template<typename same_endian_type>
-class file_istream
-{
-public:
-	file_istream() : input_file_ptr(nullptr), file_size(0L), read_length(0L) {}
-	file_istream(const char * file) : input_file_ptr(nullptr), file_size(0L), read_length(0L)
-	{
-		open(file);
-	}
-#ifdef _MSC_VER
-	file_istream(const wchar_t * file) : input_file_ptr(nullptr), file_size(0L), read_length(0L)
-	{
-		open(file);
-	}
-#endif
-	~file_istream()
+	struct istream_tag { };
+	struct ostream_tag { };
+
+	template<typename T>
+	struct void_type
 	{
-		close();
-	}
-	void open(const char * file)
+		typedef void type;
+	};
+
+	// every stream class declares its stream_category and endian_type
+	template<typename Stream, typename Tag, typename = void>
+	struct has_stream_category : std::false_type { };
+
+	template<typename Stream, typename Tag>
+	struct has_stream_category<Stream, Tag, typename void_type<typename Stream::stream_category>::type>
+		: std::is_same<typename Stream::stream_category, Tag> { };
+
+	template<typename Stream>
+	struct is_istream : has_stream_category<Stream, istream_tag> { };
+
+	template<typename Stream>
+	struct is_ostream : has_stream_category<Stream, ostream_tag> { };
+
+// Placed in a struct after its data members, SIMPLE_BINSTREAM_FIELDS(a, b, c)
+// makes the struct readable and writable with every stream; the fields are
+// written in the order listed.
+#define SIMPLE_BINSTREAM_FIELDS(...) \
+	auto simple_binstream_fields() -> decltype(std::tie(__VA_ARGS__)) { return std::tie(__VA_ARGS__); } \
+	auto simple_binstream_fields() const -> decltype(std::tie(__VA_ARGS__)) { return std::tie(__VA_ARGS__); }
+
+	template<typename T, typename = void>
+	struct has_fields : std::false_type { };
+
+	template<typename T>
+	struct has_fields<T, typename void_type<decltype(std::declval<const T&>().simple_binstream_fields())>::type> : std::true_type { };
+
+	template<typename Tuple>
+	struct fields_size;
+
+	template<>
+	struct fields_size<std::tuple<> > : std::integral_constant<size_t, 0> { };
+
+	template<typename Head, typename... Rest>
+	struct fields_size<std::tuple<Head, Rest...> >
+		: std::integral_constant<size_t, sizeof(typename std::remove_reference<Head>::type) + fields_size<std::tuple<Rest...> >::value> { };
+
+	template<typename Tuple>
+	struct all_bitwise_serializable;
+
+	// True when the in-memory bytes of T can be its serialized form:
+	// numbers, enums, arrays of them and SIMPLE_BINSTREAM_FIELDS structs which
+	// are trivially copyable and have no padding. For a struct, the fields
+	// must also be listed in the order of their offsets, which is only known
+	// on an object and checked by detail::in_field_order().
+	template<typename T, typename = void>
+	struct is_bitwise_serializable : std::integral_constant<bool, std::is_arithmetic<T>::value || std::is_enum<T>::value> { };
+
+	template<typename T, size_t N>
+	struct is_bitwise_serializable<T[N], void> : is_bitwise_serializable<T> { };
+
+	template<typename T>
+	struct is_bitwise_serializable<T, typename std::enable_if<has_fields<T>::value>::type>
+		: std::integral_constant<bool, std::is_trivially_copyable<T>::value
+			&& sizeof(T) == fields_size<decltype(std::declval<T&>().simple_binstream_fields())>::value
+			&& all_bitwise_serializable<decltype(std::declval<T&>().simple_binstream_fields())>::value> { };
+
+	template<>
+	struct all_bitwise_serializable<std::tuple<> > : std::true_type { };
+
+	template<typename Head, typename... Rest>
+	struct all_bitwise_serializable<std::tuple<Head, Rest...> >
+		: std::integral_constant<bool, is_bitwise_serializable<typename std::remove_cv<typename std::remove_reference<Head>::type>::type>::value
+			&& all_bitwise_serializable<std::tuple<Rest...> >::value> { };
+
+namespace detail
+{
+	// a single memcpy is only right when no byte swapping is needed
+	template<typename Stream, typename T>
+	struct use_bitwise_copy : std::integral_constant<bool, is_bitwise_serializable<T>::value && Stream::endian_type::value> { };
+
+	// T is deduced with its const, as only the addresses of the fields are
+	// taken; the object may not be initialized yet
+	template<typename T>
+	typename std::enable_if<!has_fields<T>::value, bool>::type in_field_order(T&)
 	{
-		close();
-#ifdef _MSC_VER
-		input_file_ptr = nullptr;
-		fopen_s(&input_file_ptr, file, "rb");
-#else
-		input_file_ptr = std::fopen(file, "rb");
-#endif
-		compute_length();
+		return true;
 	}
-#ifdef _MSC_VER
-	void open(const wchar_t * file)
+	template<typename T, size_t N>
+	bool in_field_order(T (&arr)[N])
 	{
-		close();
-		input_file_ptr = nullptr;
-		_wfopen_s(&input_file_ptr, file, L"rb");
-		compute_length();
+		return in_field_order(arr[0]);
 	}
-#endif
-	void close()
+	template<typename T>
+	typename std::enable_if<has_fields<T>::value, bool>::type in_field_order(T& val);
+
+	template<size_t I, size_t N>
+	struct fields_io
 	{
-		if (input_file_ptr)
+		template<typename Stream, typename Tuple>
+		static void write(Stream& ostm, const Tuple& fields)
 		{
-			fclose(input_file_ptr);
-			input_file_ptr = nullptr;
+			ostm << std::get<I>(fields);
+			fields_io<I + 1, N>::write(ostm, fields);
 		}
-	}
-	bool is_open()
+		template<typename Stream, typename Tuple>
+		static void read(Stream& istm, Tuple& fields)
+		{
+			istm >> std::get<I>(fields);
+			fields_io<I + 1, N>::read(istm, fields);
+		}
+		// true when each field starts where the one before it ends
+		template<typename Tuple>
+		static bool in_order(const Tuple& fields, const char* base, size_t offset)
+		{
+			typedef typename std::remove_reference<typename std::tuple_element<I, Tuple>::type>::type field_type;
+			return reinterpret_cast<const char*>(&std::get<I>(fields)) == base + offset
+				&& in_field_order(std::get<I>(fields))
+				&& fields_io<I + 1, N>::in_order(fields, base, offset + sizeof(field_type));
+		}
+	};
+
+	template<size_t N>
+	struct fields_io<N, N>
 	{
-		return (input_file_ptr != nullptr);
-	}
-	long file_length() const
+		template<typename Stream, typename Tuple>
+		static void write(Stream&, const Tuple&) {}
+		template<typename Stream, typename Tuple>
+		static void read(Stream&, Tuple&) {}
+		template<typename Tuple>
+		static bool in_order(const Tuple&, const char*, size_t)
+		{
+			return true;
+		}
+	};
+
+	// A struct is copied as a block only when its fields are listed in
+	// memory order; otherwise the block would not be in the listed order.
+	template<typename T>
+	typename std::enable_if<has_fields<T>::value, bool>::type in_field_order(T& val)
 	{
-		return file_size;
+		typedef decltype(val.simple_binstream_fields()) tuple_type;
+		return fields_io<0, std::tuple_size<tuple_type>::value>::in_order(val.simple_binstream_fields(), reinterpret_cast<const char*>(&val), 0);
 	}
-	// http://www.cplusplus.com/reference/cstdio/feof/
-	// stream's internal position indicator may point to the end-of-file for the 
-	// next operation, but still, the end-of-file indicator may not be set until 
-	// an operation attempts to read at that point.
-	bool eof() const // not using feof(), see above
+
+	template<typename Stream, typename T>
+	void write_object(Stream& ostm, const T& val, std::false_type);
+
+	template<typename Stream, typename T>
+	void write_object(Stream& ostm, const T& val, std::true_type)
 	{
-		return read_length >= file_size;
+		if (in_field_order(val))
+			ostm.write(reinterpret_cast<const char*>(&val), sizeof(T));
+		else
+			write_object(ostm, val, std::false_type());
 	}
-	long tellg() const
+
+	template<typename Stream, typename T>
+	void write_object(Stream& ostm, const T& val, std::false_type)
 	{
-		return std::ftell(input_file_ptr);
+		typedef decltype(val.simple_binstream_fields()) tuple_type;
+		fields_io<0, std::tuple_size<tuple_type>::value>::write(ostm, val.simple_binstream_fields());
 	}
-	void seekg (long pos)
+
+	template<typename Stream, typename T>
+	void read_object(Stream& istm, T& val, std::false_type);
+
+	template<typename Stream, typename T>
+	void read_object(Stream& istm, T& val, std::true_type)
 	{
-		std::fseek(input_file_ptr, pos, SEEK_SET);
-		read_length = pos;
+		if (in_field_order(val))
+			istm.read(reinterpret_cast<char*>(&val), sizeof(T));
+		else
+			read_object(istm, val, std::false_type());
 	}
-	void seekg (long offset, int way)
+
+	template<typename Stream, typename T>
+	void read_object(Stream& istm, T& val, std::false_type)
 	{
-		std::fseek(input_file_ptr, offset, way);
-		if (way == SEEK_END)
-			read_length = file_size - offset;
-		else if (way == SEEK_CUR)
-			read_length += offset;
-		else
-			read_length = offset;
+		typedef decltype(val.simple_binstream_fields()) tuple_type;
+		tuple_type fields = val.simple_binstream_fields();
+		fields_io<0, std::tuple_size<tuple_type>::value>::read(istm, fields);
 	}
 
-	template<typename T>
-	void read(T& t)
+	template<typename Stream, typename T>
+	void write_array(Stream& ostm, const T* p, size_t count, std::false_type)
 	{
-		if(std::fread(reinterpret_cast<void*>(&t), sizeof(T), 1, input_file_ptr) != 1)
-		{
-			throw std::runtime_error("Read Error!");
-		}
-		read_length += sizeof(T);
-		simple::swap_endian_if_same_endian_is_false(t, m_same_type);
+		for (size_t i = 0; i < count; ++i)
+			ostm << p[i];
 	}
-	void read(typename std::vector<char>& vec)
+
+	template<typename Stream, typename T>
+	void write_array(Stream& ostm, const T* p, size_t count, std::true_type)
 	{
-		if (std::fread(reinterpret_cast<void*>(&vec[0]), vec.size(), 1, input_file_ptr) != 1)
-		{
-			throw std::runtime_error("Read Error!");
-		}
-		read_length += vec.size();
+		if (count > 0 && in_field_order(p[0]))
+			ostm.write(reinterpret_cast<const char*>(p), count * sizeof(T));
+		else
+			write_array(ostm, p, count, std::false_type());
 	}
-	void read(char* p, size_t size)
+
+	template<typename Stream, typename T>
+	void read_array(Stream& istm, T* p, size_t count, std::false_type)
 	{
-		if (std::fread(reinterpret_cast<void*>(p), size, 1, input_file_ptr) != 1)
-		{
-			throw std::runtime_error("Read Error!");
-		}
-		read_length += size;
+		for (size_t i = 0; i < count; ++i)
+			istm >> p[i];
 	}
-private:
-	void compute_length()
+
+	template<typename Stream, typename T>
+	void read_array(Stream& istm, T* p, size_t count, std::true_type)
 	{
-		seekg(0, SEEK_END);
-		file_size = tellg();
-		seekg(0, SEEK_SET);
+		if (count > 0 && in_field_order(p[0]))
+			istm.read(reinterpret_cast<char*>(p), count * sizeof(T));
+		else
+			read_array(istm, p, count, std::false_type());
 	}
+} // ns detail
 
-	std::FILE* input_file_ptr;
-	long file_size;
-	long read_length;
-	same_endian_type m_same_type;
-};
+// Writes count objects; a single block copy when T is bitwise serializable.
+template<typename Stream, typename T>
+void write_array(Stream& ostm, const T* p, size_t count)
+{
+	detail::write_array(ostm, p, count, detail::use_bitwise_copy<Stream, T>());
+}
+
+template<typename Stream, typename T>
+void read_array(Stream& istm, T* p, size_t count)
+{
+	detail::read_array(istm, p, count, detail::use_bitwise_copy<Stream, T>());
+}
 
-template<typename same_endian_type, typename T>
- file_istream<same_endian_type>& operator >> ( file_istream<same_endian_type>& istm, T& val)
+template<typename Stream, typename T>
+typename std::enable_if<is_istream<Stream>::value && !has_fields<T>::value, Stream&>::type
+ operator >> (Stream& istm, T& val)
 {
 	istm.read(val);
 
 	return istm;
 }
 
-template<typename same_endian_type>
- file_istream<same_endian_type>& operator >> ( file_istream<same_endian_type>& istm, std::string& val)
+template<typename Stream, typename T>
+typename std::enable_if<is_ostream<Stream>::value && !has_fields<T>::value, Stream&>::type
+ operator << (Stream& ostm, const T& val)
 {
-	val.clear();
-
-	int size = 0;
-	istm.read(size);
+	ostm.write(val);
 
-	if(size<=0)
-		return istm;
+	return ostm;
+}
 
-	std::vector<char> vec((size_t)size);
-	istm.read(vec);
-	val.assign(&vec[0], (size_t)size);
+template<typename Stream, typename T>
+typename std::enable_if<is_istream<Stream>::value && has_fields<T>::value, Stream&>::type
+ operator >> (Stream& istm, T& val)
+{
+	detail::read_object(istm, val, detail::use_bitwise_copy<Stream, T>());
 
 	return istm;
 }
 
-template<typename same_endian_type>
-class mem_istream
+template<typename Stream, typename T>
+typename std::enable_if<is_ostream<Stream>::value && has_fields<T>::value, Stream&>::type
+ operator << (Stream& ostm, const T& val)
 {
-public:
-	mem_istream() : m_index(0) {}
-	mem_istream(const char * mem, size_t size) 
-	{
-		open(mem, size);
-	}
-	mem_istream(const std::vector<char>& vec) 
-	{
-		m_index = 0;
-		m_vec.reserve(vec.size());
-		m_vec.assign(vec.begin(), vec.end());
-	}
-	void open(const char * mem, size_t size)
+	detail::write_object(ostm, val, detail::use_bitwise_copy<Stream, T>());
+
+	return ostm;
+}
+
+namespace detail
+{
+	// the bytes a buffer sized from an untrusted length grows by at a time
+	const size_t read_step = 1 << 16;
+
+	// streams which know their size have remaining() and require(size);
+	// for chunk_istream they cover the bytes buffered so far
+	template<typename Stream, typename = void>
+	struct has_remaining : std::false_type { };
+
+	template<typename Stream>
+	struct has_remaining<Stream, typename void_type<decltype(std::declval<const Stream&>().remaining())>::type> : std::true_type { };
+
+	// chunk_istream does not throw when it runs out of data; it sets
+	// need_more() and ignores the later reads, so a loop sized from the
+	// data has to stop there rather than allocate for the whole count
+	template<typename Stream, typename = void>
+	struct has_need_more : std::false_type { };
+
+	template<typename Stream>
+	struct has_need_more<Stream, typename void_type<decltype(std::declval<const Stream&>().need_more())>::type> : std::true_type { };
+
+	template<typename Stream>
+	bool stopped(const Stream& istm, std::true_type)
 	{
-		m_index = 0;
-		m_vec.clear();
-		m_vec.reserve(size);
-		m_vec.assign(mem, mem + size);
+		return istm.need_more();
 	}
-	void close()
+
+	template<typename Stream>
+	bool stopped(const Stream&, std::false_type)
 	{
-		m_vec.clear();
+		return false;
 	}
-	bool eof() const
+
+	template<typename Stream>
+	bool stopped(const Stream& istm)
 	{
-		return m_index >= m_vec.size();
+		return stopped(istm, has_need_more<Stream>());
 	}
-	std::ifstream::pos_type tellg() const
+
+	// the elements a buffer may be sized for at once: all of them once the
+	// stream confirmed it has the bytes, else read_step bytes of them
+	template<typename Stream>
+	size_t first_step(Stream& istm, size_t count, size_t elem_size, std::true_type)
 	{
-		return m_index;
+		istm.require((uint64_t)count * elem_size);
+		return count;
 	}
-	bool seekg (size_t pos)
-	{
-		if(pos<m_vec.size())
-			m_index = pos;
-		else 
-			return false;
 
-		return true;
-	}
-	bool seekg (std::streamoff offset, std::ios_base::seekdir way)
+	template<typename Stream>
+	size_t first_step(Stream&, size_t count, size_t elem_size, std::false_type)
 	{
-		if(way==std::ios_base::beg && offset < m_vec.size())
-			m_index = offset;
-		else if(way==std::ios_base::cur && (m_index + offset) < m_vec.size())
-			m_index += offset;
-		else if(way==std::ios_base::end && (m_vec.size() + offset) < m_vec.size())
-			m_index = m_vec.size() + offset;
-		else
-			return false;
-
-		return true;
+		return std::min(count, std::max<size_t>(1, read_step / elem_size));
 	}
 
-	const std::vector<char>& get_internal_vec()
+	template<typename Stream>
+	void read_block(Stream& istm, char* p, size_t count)
 	{
-		return m_vec;
+		istm.read(p, count);
 	}
 
-	template<typename T>
-	void read(T& t)
+	template<typename Stream, typename T>
+	void read_block(Stream& istm, T* p, size_t count)
 	{
-		if(eof())
-			throw std::runtime_error("Premature end of array!");
-
-		if((m_index + sizeof(T)) > m_vec.size())
-			throw std::runtime_error("Premature end of array!");
-
-		std::memcpy(reinterpret_cast<void*>(&t), &m_vec[m_index], sizeof(T));
-
-		simple::swap_endian_if_same_endian_is_false(t, m_same_type);
-
-		m_index += sizeof(T);
+		read_array(istm, p, count);
 	}
 
-	void read(typename std::vector<char>& vec)
+	// Reads count elements into a string or vector, resized to hold them.
+	// The count comes from the data, so it is not trusted with an
+	// allocation: a stream which knows its size fails before allocating
+	// when the bytes are not there, others grow the buffer as they arrive.
+	template<typename Stream, typename Buffer>
+	void read_bounded(Stream& istm, Buffer& buf, size_t count)
 	{
-		if (eof())
-			throw std::runtime_error("Premature end of array!");
-
-		if ((m_index + vec.size()) > m_vec.size())
-			throw std::runtime_error("Premature end of array!");
-
-		std::memcpy(reinterpret_cast<void*>(&vec[0]), &m_vec[m_index], vec.size());
-
-		m_index += vec.size();
+		typedef typename Buffer::value_type T;
+		size_t step = first_step(istm, count, sizeof(T), has_remaining<Stream>());
+		for (size_t done = 0; done < count && !stopped(istm); )
+		{
+			size_t n = std::min(step, count - done);
+			buf.resize(done + n);
+			read_block(istm, &buf[done], n);
+			done += n;
+		}
 	}
 
-	void read(char* p, size_t size)
+	// reads a string of size bytes, which is left empty when the read fails
+	template<typename Stream, typename String>
+	void read_string(Stream& istm, String& str, size_t size)
 	{
-		if(eof())
-			throw std::runtime_error("Premature end of array!");
-
-		if((m_index + size) > m_vec.size())
-			throw std::runtime_error("Premature end of array!");
-
-		std::memcpy(reinterpret_cast<void*>(p), &m_vec[m_index], size);
-
-		m_index += size;
+		try
+		{
+			read_bounded(istm, str, size);
+		}
+		catch (...)
+		{
+			str.clear();
+			throw;
+		}
 	}
+} // ns detail
 
-	void read(std::string& str, const unsigned int size)
-	{
-		if (eof())
-			throw std::runtime_error("Premature end of array!");
+// Strings with another allocator or traits, e.g. std::pmr::string, use the
+// same format as std::string and are filled through their own allocator.
+template<typename Stream, typename Tr, typename A>
+typename std::enable_if<is_istream<Stream>::value, Stream&>::type
+ operator >> (Stream& istm, std::basic_string<char, Tr, A>& val)
+{
+	val.clear();
 
-		if ((m_index + size) > m_vec.size())
-			throw std::runtime_error("Premature end of array!");
+	int size = 0;
+	istm.read(size);
 
-		str.assign(&m_vec[m_index], size);
+	if (size <= 0)
+		return istm;
 
-		m_index += str.size();
-	}
+	detail::read_string(istm, val, (size_t)size);
 
-private:
-	std::vector<char> m_vec;
-	size_t m_index;
-	same_endian_type m_same_type;
-};
+	return istm;
+}
 
-template<typename same_endian_type, typename T>
- mem_istream<same_endian_type>& operator >> ( mem_istream<same_endian_type>& istm, T& val)
+template<typename Stream, typename Tr, typename A>
+typename std::enable_if<is_ostream<Stream>::value, Stream&>::type
+ operator << (Stream& ostm, const std::basic_string<char, Tr, A>& val)
 {
-	istm.read(val);
+	int size = (int)val.size();
+	ostm.write(size);
 
-	return istm;
+	if (size <= 0)
+		return ostm;
+
+	ostm.write(val.data(), val.size());
+
+	return ostm;
 }
 
-template<typename same_endian_type>
-mem_istream<same_endian_type>& operator >> (mem_istream<same_endian_type>& istm, std::string& val)
+template<typename Stream>
+typename std::enable_if<is_ostream<Stream>::value, Stream&>::type
+ operator << (Stream& ostm, const char* val)
 {
-	val.clear();
-
-	int size = 0;
-	istm.read(size);
+	int size = (int)std::strlen(val);
+	ostm.write(size);
 
-	if(size<=0)
-		return istm;
+	if (size <= 0)
+		return ostm;
 
-	istm.read(val, size);
+	ostm.write(val, (size_t)size);
 
-	return istm;
+	return ostm;
 }
 
-template<typename same_endian_type>
-class ptr_istream
+namespace detail
 {
-public:
-	ptr_istream() : m_arr(nullptr), m_size(0), m_index(0) {}
-	ptr_istream(const char * mem, size_t size) : m_arr(nullptr), m_size(0), m_index(0)
+	// An element decoded outside its container is constructed with the
+	// container's allocator when it takes one, so that moving it into the
+	// container does not copy it, e.g. a std::pmr::string key of a std::pmr::map.
+	template<typename T, typename Alloc>
+	T make_element(const Alloc& alloc, std::true_type)
 	{
-		open(mem, size);
+		return T(alloc);
 	}
-	ptr_istream(const std::vector<char>& vec)
+
+	template<typename T, typename Alloc>
+	T make_element(const Alloc&, std::false_type)
 	{
-		m_index = 0;
-		m_arr = vec.data();
-		m_size = vec.size();
+		return T();
 	}
-	void open(const char * mem, size_t size)
+
+	template<typename T, typename Alloc>
+	T make_element(const Alloc& alloc)
 	{
-		m_index = 0;
-		m_arr = mem;
-		m_size = size;
+		return make_element<T>(alloc, std::integral_constant<bool,
+			std::uses_allocator<T, Alloc>::value && std::is_constructible<T, const Alloc&>::value>());
 	}
-	void close()
+
+	template<typename Stream>
+	int read_count(Stream& istm)
 	{
-		m_arr = nullptr; m_size = 0; m_index = 0;
+		int size = 0;
+		istm >> size;
+		return (size > 0) ? size : 0;
 	}
-	bool eof() const
+
+	template<typename Stream>
+	size_t reserve_limit(const Stream& istm, size_t elem_size, std::true_type)
 	{
-		return m_index >= m_size;
+		return (size_t)std::min<uint64_t>(istm.remaining() / elem_size, SIZE_MAX);
 	}
-	std::ifstream::pos_type tellg() const
+
+	template<typename Stream>
+	size_t reserve_limit(const Stream&, size_t elem_size, std::false_type)
 	{
-		return m_index;
+		return std::max<size_t>(1, read_step / elem_size);
 	}
-	bool seekg(size_t pos)
-	{
-		if (pos<m_size)
-			m_index = pos;
-		else
-			return false;
 
-		return true;
-	}
-	bool seekg(std::streamoff offset, std::ios_base::seekdir way)
+	// The part of a count read from the data which is reserved up front. It
+	// takes no more memory than the bytes left in the stream, or read_step
+	// bytes when the stream does not know its size; the container grows
+	// for the rest.
+	template<typename Stream>
+	size_t reserve_count(const Stream& istm, int count, size_t elem_size)
 	{
-		if (way == std::ios_base::beg && offset < m_size)
-			m_index = offset;
-		else if (way == std::ios_base::cur && (m_index + offset) < m_size)
-			m_index += offset;
-		else if (way == std::ios_base::end && (m_size + offset) < m_size)
-			m_index = m_size + offset;
-		else
-			return false;
+		return std::min((size_t)count, reserve_limit(istm, elem_size, has_remaining<Stream>()));
+	}
 
-		return true;
+	template<typename Stream, typename Container>
+	void write_elements(Stream& ostm, const Container& con)
+	{
+		ostm << (int)con.size();
+		for (typename Container::const_iterator it = con.begin(); it != con.end(); ++it)
+			ostm << *it;
 	}
 
-	template<typename T>
-	void read(T& t)
+	template<typename Stream, typename Container>
+	void read_back_elements(Stream& istm, Container& con, int size)
 	{
-		if (eof())
-			throw std::runtime_error("Premature end of array!");
+		for (int i = 0; i < size && !stopped(istm); ++i)
+		{
+			con.emplace_back();
+			istm >> con.back();
+		}
+	}
 
-		if ((m_index + sizeof(T)) > m_size)
-			throw std::runtime_error("Premature end of array!");
+	template<typename Stream, typename Map>
+	void write_pairs(Stream& ostm, const Map& map)
+	{
+		ostm << (int)map.size();
+		for (typename Map::const_iterator it = map.begin(); it != map.end(); ++it)
+			ostm << it->first << it->second;
+	}
 
-		std::memcpy(reinterpret_cast<void*>(&t), &m_arr[m_index], sizeof(T));
+	// the key is decoded first, the value straight into the node
+	template<typename Stream, typename Map>
+	void read_sorted_pairs(Stream& istm, Map& map, int size)
+	{
+		for (int i = 0; i < size && !stopped(istm); ++i)
+		{
+			typename Map::key_type key = make_element<typename Map::key_type>(map.get_allocator());
+			istm >> key;
+			typename Map::iterator it = map.emplace_hint(map.end(), std::piecewise_construct,
+				std::forward_as_tuple(std::move(key)), std::forward_as_tuple());
+			istm >> it->second;
+		}
+	}
 
-		simple::swap_endian_if_same_endian_is_false(t, m_same_type);
+	template<typename Stream, typename Map>
+	void read_hashed_pairs(Stream& istm, Map& map, int size)
+	{
+		for (int i = 0; i < size && !stopped(istm); ++i)
+		{
+			typename Map::key_type key = make_element<typename Map::key_type>(map.get_allocator());
+			istm >> key;
+			typename Map::iterator it = map.emplace(std::piecewise_construct,
+				std::forward_as_tuple(std::move(key)), std::forward_as_tuple()).first;
+			istm >> it->second;
+		}
+	}
 
-		m_index += sizeof(T);
+	template<typename Stream, typename Set>
+	void read_keys(Stream& istm, Set& set, int size)
+	{
+		for (int i = 0; i < size && !stopped(istm); ++i)
+		{
+			typename Set::key_type key = make_element<typename Set::key_type>(set.get_allocator());
+			istm >> key;
+			set.emplace_hint(set.end(), std::move(key));
+		}
 	}
 
-	void read(typename std::vector<char>& vec)
+	template<typename Stream, typename T, typename A>
+	void read_vector(Stream& istm, std::vector<T, A>& vec, int size, std::true_type)
 	{
-		if (eof())
-			throw std::runtime_error("Premature end of array!");
+		read_bounded(istm, vec, (size_t)size);
+	}
 
-		if ((m_index + vec.size()) > m_size)
-			throw std::runtime_error("Premature end of array!");
+	template<typename Stream, typename T, typename A>
+	void read_vector(Stream& istm, std::vector<T, A>& vec, int size, std::false_type)
+	{
+		vec.reserve(reserve_count(istm, size, sizeof(T)));
+		read_back_elements(istm, vec, size);
+	}
 
-		std::memcpy(reinterpret_cast<void*>(&vec[0]), &m_arr[m_index], vec.size());
+	// std::vector<char> keeps its old meaning of raw bytes without a count,
+	// served by the write(const std::vector<char>&) and read(std::vector<char>&) members
+	template<typename T, typename A>
+	struct is_raw_char_vector : std::is_same<std::vector<T, A>, std::vector<char> > { };
+} // ns detail
+
+// Containers are written as an int element count followed by the elements.
+// Readers replace the content, reserve from the count where the container
+// allows it, as far as the data can hold that many elements, and decode
+// each element in place.
+template<typename Stream, typename T, typename A>
+typename std::enable_if<is_ostream<Stream>::value && !detail::is_raw_char_vector<T, A>::value, Stream&>::type
+ operator << (Stream& ostm, const std::vector<T, A>& vec)
+{
+	ostm << (int)vec.size();
+	write_array(ostm, vec.data(), vec.size());
 
-		m_index += vec.size();
-	}
+	return ostm;
+}
 
-	void read(char* p, size_t size)
-	{
-		if (eof())
-			throw std::runtime_error("Premature end of array!");
+template<typename Stream, typename A>
+typename std::enable_if<is_ostream<Stream>::value, Stream&>::type
+ operator << (Stream& ostm, const std::vector<bool, A>& vec)
+{
+	detail::write_elements(ostm, vec);
 
-		if ((m_index + size) > m_size)
-			throw std::runtime_error("Premature end of array!");
+	return ostm;
+}
 
-		std::memcpy(reinterpret_cast<void*>(p), &m_arr[m_index], size);
+template<typename Stream, typename T, typename A>
+typename std::enable_if<is_istream<Stream>::value && !detail::is_raw_char_vector<T, A>::value, Stream&>::type
+ operator >> (Stream& istm, std::vector<T, A>& vec)
+{
+	vec.clear();
+	int size = detail::read_count(istm);
+	detail::read_vector(istm, vec, size, detail::use_bitwise_copy<Stream, T>());
 
-		m_index += size;
-	}
+	return istm;
+}
 
-	void read(std::string& str, const unsigned int size)
+template<typename Stream, typename A>
+typename std::enable_if<is_istream<Stream>::value, Stream&>::type
+ operator >> (Stream& istm, std::vector<bool, A>& vec)
+{
+	vec.clear();
+	int size = detail::read_count(istm);
+	vec.reserve(detail::reserve_count(istm, size, 1));
+	for (int i = 0; i < size && !detail::stopped(istm); ++i)
 	{
-		if (eof())
-			throw std::runtime_error("Premature end of array!");
+		bool val = false;
+		istm >> val;
+		vec.push_back(val);
+	}
 
-		if ((m_index + size) > m_size)
-			throw std::runtime_error("Premature end of array!");
+	return istm;
+}
 
-		str.assign(&m_arr[m_index], size);
+template<typename Stream, typename T, typename A>
+typename std::enable_if<is_ostream<Stream>::value, Stream&>::type
+ operator << (Stream& ostm, const std::deque<T, A>& con)
+{
+	detail::write_elements(ostm, con);
 
-		m_index += str.size();
-	}
+	return ostm;
+}
 
-private:
-	const char* m_arr;
-	size_t m_size;
-	size_t m_index;
-	same_endian_type m_same_type;
-};
+template<typename Stream, typename T, typename A>
+typename std::enable_if<is_istream<Stream>::value, Stream&>::type
+ operator >> (Stream& istm, std::deque<T, A>& con)
+{
+	con.clear();
+	detail::read_back_elements(istm, con, detail::read_count(istm));
 
+	return istm;
+}
 
-template<typename same_endian_type, typename T>
- ptr_istream<same_endian_type>& operator >> ( ptr_istream<same_endian_type>& istm, T& val)
+template<typename Stream, typename T, typename A>
+typename std::enable_if<is_ostream<Stream>::value, Stream&>::type
+ operator << (Stream& ostm, const std::list<T, A>& con)
 {
-	istm.read(val);
+	detail::write_elements(ostm, con);
+
+	return ostm;
+}
+
+template<typename Stream, typename T, typename A>
+typename std::enable_if<is_istream<Stream>::value, Stream&>::type
+ operator >> (Stream& istm, std::list<T, A>& con)
+{
+	con.clear();
+	detail::read_back_elements(istm, con, detail::read_count(istm));
 
 	return istm;
 }
 
-template<typename same_endian_type>
- ptr_istream<same_endian_type>& operator >> ( ptr_istream<same_endian_type>& istm, std::string& val)
+template<typename Stream, typename T, size_t N>
+typename std::enable_if<is_ostream<Stream>::value, Stream&>::type
+ operator << (Stream& ostm, const std::array<T, N>& arr)
 {
-	val.clear();
-	
-	int size = 0;
-	istm.read(size);
+	// the size is part of the type, so no count is written
+	write_array(ostm, arr.data(), N);
 
-	if (size <= 0)
-		return istm;
+	return ostm;
+}
 
-	istm.read(val, size);
+template<typename Stream, typename T, size_t N>
+typename std::enable_if<is_istream<Stream>::value, Stream&>::type
+ operator >> (Stream& istm, std::array<T, N>& arr)
+{
+	read_array(istm, arr.data(), N);
 
 	return istm;
 }
 
-template<typename same_endian_type>
-class memfile_istream
+template<typename Stream, typename K, typename V, typename C, typename A>
+typename std::enable_if<is_ostream<Stream>::value, Stream&>::type
+ operator << (Stream& ostm, const std::map<K, V, C, A>& map)
 {
-public:
-	memfile_istream() : m_arr(nullptr), m_size(0), m_index(0) {}
-	memfile_istream(const char * file) : m_arr(nullptr), m_size(0), m_index(0)
-	{
-		open(file);
-	}
-#ifdef _MSC_VER
-	memfile_istream(const wchar_t * file) : m_arr(nullptr), m_size(0), m_index(0)
-	{
-		open(file);
-	}
-#endif
-	~memfile_istream()
-	{
-		close();
-	}
-	void open(const char * file)
-	{
-		close();
-#ifdef _MSC_VER
-		std::FILE* input_file_ptr = nullptr;
-		fopen_s(&input_file_ptr, file, "rb");
-#else
-		std::FILE* input_file_ptr = std::fopen(file, "rb");
-#endif
-		compute_length(input_file_ptr);
-		m_arr = new char[m_size];
-		std::fread(m_arr, m_size, 1, input_file_ptr);
-		fclose(input_file_ptr);
-	}
-#ifdef _MSC_VER
-	void open(const wchar_t * file)
+	detail::write_pairs(ostm, map);
+
+	return ostm;
+}
+
+template<typename Stream, typename K, typename V, typename C, typename A>
+typename std::enable_if<is_istream<Stream>::value, Stream&>::type
+ operator >> (Stream& istm, std::map<K, V, C, A>& map)
+{
+	map.clear();
+	detail::read_sorted_pairs(istm, map, detail::read_count(istm));
+
+	return istm;
+}
+
+template<typename Stream, typename K, typename V, typename C, typename A>
+typename std::enable_if<is_ostream<Stream>::value, Stream&>::type
+ operator << (Stream& ostm, const std::multimap<K, V, C, A>& map)
+{
+	detail::write_pairs(ostm, map);
+
+	return ostm;
+}
+
+template<typename Stream, typename K, typename V, typename C, typename A>
+typename std::enable_if<is_istream<Stream>::value, Stream&>::type
+ operator >> (Stream& istm, std::multimap<K, V, C, A>& map)
+{
+	map.clear();
+	detail::read_sorted_pairs(istm, map, detail::read_count(istm));
+
+	return istm;
+}
+
+template<typename Stream, typename K, typename V, typename H, typename E, typename A>
+typename std::enable_if<is_ostream<Stream>::value, Stream&>::type
+ operator << (Stream& ostm, const std::unordered_map<K, V, H, E, A>& map)
+{
+	detail::write_pairs(ostm, map);
+
+	return ostm;
+}
+
+template<typename Stream, typename K, typename V, typename H, typename E, typename A>
+typename std::enable_if<is_istream<Stream>::value, Stream&>::type
+ operator >> (Stream& istm, std::unordered_map<K, V, H, E, A>& map)
+{
+	map.clear();
+	int size = detail::read_count(istm);
+	map.reserve(detail::reserve_count(istm, size, sizeof(typename std::unordered_map<K, V, H, E, A>::value_type)));
+	detail::read_hashed_pairs(istm, map, size);
+
+	return istm;
+}
+
+template<typename Stream, typename K, typename C, typename A>
+typename std::enable_if<is_ostream<Stream>::value, Stream&>::type
+ operator << (Stream& ostm, const std::set<K, C, A>& set)
+{
+	detail::write_elements(ostm, set);
+
+	return ostm;
+}
+
+template<typename Stream, typename K, typename C, typename A>
+typename std::enable_if<is_istream<Stream>::value, Stream&>::type
+ operator >> (Stream& istm, std::set<K, C, A>& set)
+{
+	set.clear();
+	detail::read_keys(istm, set, detail::read_count(istm));
+
+	return istm;
+}
+
+template<typename Stream, typename K, typename H, typename E, typename A>
+typename std::enable_if<is_ostream<Stream>::value, Stream&>::type
+ operator << (Stream& ostm, const std::unordered_set<K, H, E, A>& set)
+{
+	detail::write_elements(ostm, set);
+
+	return ostm;
+}
+
+template<typename Stream, typename K, typename H, typename E, typename A>
+typename std::enable_if<is_istream<Stream>::value, Stream&>::type
+ operator >> (Stream& istm, std::unordered_set<K, H, E, A>& set)
+{
+	set.clear();
+	int size = detail::read_count(istm);
+	set.reserve(detail::reserve_count(istm, size, sizeof(K)));
+	detail::read_keys(istm, set, size);
+
+	return istm;
+}
+
+template<typename Stream, typename T1, typename T2>
+typename std::enable_if<is_ostream<Stream>::value, Stream&>::type
+ operator << (Stream& ostm, const std::pair<T1, T2>& val)
+{
+	return ostm << val.first << val.second;
+}
+
+template<typename Stream, typename T1, typename T2>
+typename std::enable_if<is_istream<Stream>::value, Stream&>::type
+ operator >> (Stream& istm, std::pair<T1, T2>& val)
+{
+	return istm >> val.first >> val.second;
+}
+
+template<typename Stream, typename... Ts>
+typename std::enable_if<is_ostream<Stream>::value, Stream&>::type
+ operator << (Stream& ostm, const std::tuple<Ts...>& val)
+{
+	detail::fields_io<0, sizeof...(Ts)>::write(ostm, val);
+
+	return ostm;
+}
+
+template<typename Stream, typename... Ts>
+typename std::enable_if<is_istream<Stream>::value, Stream&>::type
+ operator >> (Stream& istm, std::tuple<Ts...>& val)
+{
+	detail::fields_io<0, sizeof...(Ts)>::read(istm, val);
+
+	return istm;
+}
+
+#ifdef SIMPLE_BINSTREAM_CPP17
+// An optional is written as a bool followed by the value when there is one,
+// a variant as the int index of the alternative followed by its value.
+template<typename Stream, typename T>
+typename std::enable_if<is_ostream<Stream>::value, Stream&>::type
+ operator << (Stream& ostm, const std::optional<T>& val)
+{
+	ostm << val.has_value();
+	if (val.has_value())
+		ostm << *val;
+
+	return ostm;
+}
+
+template<typename Stream, typename T>
+typename std::enable_if<is_istream<Stream>::value, Stream&>::type
+ operator >> (Stream& istm, std::optional<T>& val)
+{
+	bool has_value = false;
+	istm >> has_value;
+	if (has_value)
 	{
-		close();
-		std::FILE* input_file_ptr = nullptr;
-		_wfopen_s(&input_file_ptr, file, L"rb");
-		compute_length(input_file_ptr);
-		m_arr = new char[m_size];
-		std::fread(m_arr, m_size, 1, input_file_ptr);
-		fclose(input_file_ptr);
+		val.emplace();
+		istm >> *val;
 	}
-#endif
-	void close()
+	else
+		val.reset();
+
+	return istm;
+}
+
+namespace detail
+{
+	template<size_t I, typename Stream, typename... Ts>
+	void read_variant(Stream& istm, std::variant<Ts...>& val, size_t index)
 	{
-		if (m_arr)
+		if constexpr (I < sizeof...(Ts))
 		{
-			delete[] m_arr;
-			m_arr = nullptr; m_size = 0; m_index = 0;
+			if (I == index)
+			{
+				val.template emplace<I>();
+				istm >> std::get<I>(val);
+			}
+			else
+				read_variant<I + 1>(istm, val, index);
 		}
+		else
+			throw std::runtime_error("Invalid variant index!");
 	}
-	bool is_open()
-	{
-		return (m_arr != nullptr);
-	}
-	long file_length() const
+} // ns detail
+
+template<typename Stream, typename... Ts>
+typename std::enable_if<is_ostream<Stream>::value, Stream&>::type
+ operator << (Stream& ostm, const std::variant<Ts...>& val)
+{
+	if (val.valueless_by_exception())
+		throw std::runtime_error("Variant has no value!");
+	ostm << (int)val.index();
+	std::visit([&ostm](const auto& alt) { ostm << alt; }, val);
+
+	return ostm;
+}
+
+template<typename Stream, typename... Ts>
+typename std::enable_if<is_istream<Stream>::value, Stream&>::type
+ operator >> (Stream& istm, std::variant<Ts...>& val)
+{
+	int index = -1;
+	istm >> index;
+	if (index < 0)
+		throw std::runtime_error("Invalid variant index!");
+	detail::read_variant<0>(istm, val, (size_t)index);
+
+	return istm;
+}
+#endif // SIMPLE_BINSTREAM_CPP17
+
+// Columnar batches store a vector of SIMPLE_BINSTREAM_FIELDS structs field by
+// field instead of row by row. The batch header is the int row count, the int
+// column count and per column its int element size (0 for strings) and int
+// byte size, from which the column offsets follow. A number column is a raw
+// array, a string column is row count + 1 int offsets followed by the
+// characters. read_columnar decodes only the columns selected in its mask and
+// skips over the others.
+const uint64_t all_columns = ~(uint64_t)0;
+
+inline uint64_t column_bit(size_t index)
+{
+	return (uint64_t)1 << index;
+}
+
+namespace detail
+{
+	template<size_t I, typename Row>
+	struct row_field
 	{
-		return m_size;
-	}
-	bool eof() const
+		typedef decltype(std::declval<Row&>().simple_binstream_fields()) tuple_type;
+		typedef typename std::remove_reference<typename std::tuple_element<I, tuple_type>::type>::type type;
+
+		static type& get(Row& row) { return std::get<I>(row.simple_binstream_fields()); }
+		static const type& get(const Row& row) { return std::get<I>(row.simple_binstream_fields()); }
+	};
+
+	template<typename Rows>
+	void grow_rows(Rows& rows, size_t size)
 	{
-		return m_index >= m_size;
+		if (rows.size() < size)
+			rows.resize(size);
 	}
-	std::ifstream::pos_type tellg() const
+
+	// the rows allocated before the columns are read
+	template<typename Stream>
+	size_t rows_up_front(Stream& istm, size_t count, uint64_t bytes, std::true_type)
 	{
-		return m_index;
+		istm.require(bytes);
+		return count;
 	}
-	bool seekg(size_t pos)
-	{
-		if (pos < m_size)
-			m_index = pos;
-		else
-			return false;
 
-		return true;
-	}
-	bool seekg(std::streamoff offset, std::ios_base::seekdir way)
+	template<typename Stream>
+	size_t rows_up_front(Stream&, size_t, uint64_t, std::false_type)
 	{
-		if (way == std::ios_base::beg && offset < m_size)
-			m_index = offset;
-		else if (way == std::ios_base::cur && (m_index + offset) < m_size)
-			m_index += offset;
-		else if (way == std::ios_base::end && (m_size + offset) < m_size)
-			m_index = m_size + offset;
-		else
-			return false;
-
-		return true;
+		return 0;
 	}
 
 	template<typename T>
-	void read(T& t)
+	struct column
 	{
-		if (eof())
-			throw std::runtime_error("Premature end of array!");
+		static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value,
+			"columnar fields must be numbers, enums or std::string");
 
-		if ((m_index + sizeof(T)) > m_size)
-			throw std::runtime_error("Premature end of array!");
+		static int elem_size() { return (int)sizeof(T); }
+		// whether a column of bytes can hold count rows
+		static bool fits(uint64_t count, uint64_t bytes) { return bytes == count * sizeof(T); }
 
-		std::memcpy(reinterpret_cast<void*>(&t), &m_arr[m_index], sizeof(T));
+		template<typename Field, typename Row>
+		static size_t byte_size(const Row* rows, size_t count)
+		{
+			return count * sizeof(T);
+		}
 
-		simple::swap_endian_if_same_endian_is_false(t, m_same_type);
+		template<typename Field, typename Stream, typename Row>
+		static void write(Stream& ostm, const Row* rows, size_t count)
+		{
+			std::vector<T> col(count);
+			for (size_t i = 0; i < count; ++i)
+				col[i] = Field::get(rows[i]);
+			write_array(ostm, col.data(), count);
+		}
 
-		m_index += sizeof(T);
-	}
+		template<typename Field, typename Stream, typename Rows>
+		static void read(Stream& istm, Rows& rows, size_t count, size_t)
+		{
+			std::vector<T> col;
+			size_t step = first_step(istm, count, sizeof(T), has_remaining<Stream>());
+			for (size_t done = 0; done < count; )
+			{
+				size_t n = std::min(step, count - done);
+				col.resize(n);
+				read_array(istm, col.data(), n);
+				if (stopped(istm))
+					return;
+				grow_rows(rows, done + n);
+				for (size_t i = 0; i < n; ++i)
+					Field::get(rows[done + i]) = col[i];
+				done += n;
+			}
+		}
+	};
 
-	void read(typename std::vector<char>& vec)
+	template<>
+	struct column<std::string>
 	{
-		if (eof())
-			throw std::runtime_error("Premature end of array!");
+		static int elem_size() { return 0; }
+		static bool fits(uint64_t count, uint64_t bytes) { return bytes >= (count + 1) * sizeof(int); }
 
-		if ((m_index + vec.size()) > m_size)
-			throw std::runtime_error("Premature end of array!");
+		template<typename Field, typename Row>
+		static size_t byte_size(const Row* rows, size_t count)
+		{
+			size_t size = (count + 1) * sizeof(int);
+			for (size_t i = 0; i < count; ++i)
+				size += Field::get(rows[i]).size();
+			return size;
+		}
 
-		std::memcpy(reinterpret_cast<void*>(&vec[0]), &m_arr[m_index], vec.size());
+		template<typename Field, typename Stream, typename Row>
+		static void write(Stream& ostm, const Row* rows, size_t count)
+		{
+			std::vector<int> offsets(count + 1);
+			for (size_t i = 0; i < count; ++i)
+				offsets[i + 1] = offsets[i] + (int)Field::get(rows[i]).size();
+			write_array(ostm, offsets.data(), offsets.size());
+			for (size_t i = 0; i < count; ++i)
+			{
+				const std::string& str = Field::get(rows[i]);
+				if (!str.empty())
+					ostm.write(str.data(), str.size());
+			}
+		}
 
-		m_index += vec.size();
-	}
+		template<typename Field, typename Stream, typename Rows>
+		static void read(Stream& istm, Rows& rows, size_t count, size_t bytes)
+		{
+			std::vector<int> offsets;
+			read_bounded(istm, offsets, count + 1);
+			if (stopped(istm))
+				return;
+			for (size_t i = 0; i < count; ++i)
+			{
+				if (offsets[i] < 0 || offsets[i + 1] < offsets[i])
+					throw std::runtime_error("Invalid column size!");
+			}
+			size_t blob_size = (size_t)offsets[count];
+			if (offsets[0] != 0 || bytes != (count + 1) * sizeof(int) + blob_size)
+				throw std::runtime_error("Invalid column size!");
+
+			std::vector<char> blob;
+			read_bounded(istm, blob, blob_size);
+			if (stopped(istm))
+				return;
+			grow_rows(rows, count);
+			for (size_t i = 0; i < count; ++i)
+				Field::get(rows[i]).assign(blob.data() + offsets[i], (size_t)(offsets[i + 1] - offsets[i]));
+		}
+	};
 
-	void read(char* p, size_t size)
+	template<size_t I, size_t N>
+	struct columns_io
 	{
-		if (eof())
-			throw std::runtime_error("Premature end of array!");
+		template<typename Row>
+		static void header(const Row* rows, size_t count, int* sizes)
+		{
+			typedef row_field<I, Row> field;
+			typedef column<typename std::remove_cv<typename field::type>::type> col;
+			size_t bytes = col::template byte_size<field>(rows, count);
+			if (bytes > (size_t)INT_MAX)
+				throw std::runtime_error("Column too large!");
+
+			sizes[I * 2] = col::elem_size();
+			sizes[I * 2 + 1] = (int)bytes;
+			columns_io<I + 1, N>::header(rows, count, sizes);
+		}
+		template<typename Stream, typename Row>
+		static void write(Stream& ostm, const Row* rows, size_t count)
+		{
+			typedef row_field<I, Row> field;
+			column<typename std::remove_cv<typename field::type>::type>::template write<field>(ostm, rows, count);
+			columns_io<I + 1, N>::write(ostm, rows, count);
+		}
+		// checks the column sizes of the header against the row count and
+		// returns their total
+		template<typename Row>
+		static uint64_t check(size_t count, const int* sizes)
+		{
+			typedef column<typename std::remove_cv<typename row_field<I, Row>::type>::type> col;
+			if (sizes[I * 2] != col::elem_size() || sizes[I * 2 + 1] < 0)
+				throw std::runtime_error("Column type mismatch!");
+			if (!col::fits(count, (uint64_t)sizes[I * 2 + 1]))
+				throw std::runtime_error("Invalid column size!");
 
-		if ((m_index + size) > m_size)
-			throw std::runtime_error("Premature end of array!");
+			return (uint64_t)sizes[I * 2 + 1] + columns_io<I + 1, N>::template check<Row>(count, sizes);
+		}
+		template<typename Stream, typename Rows>
+		static void read(Stream& istm, Rows& rows, size_t count, const int* sizes, uint64_t mask)
+		{
+			typedef row_field<I, typename Rows::value_type> field;
+			typedef column<typename std::remove_cv<typename field::type>::type> col;
+			if (mask & column_bit(I))
+				col::template read<field>(istm, rows, count, (size_t)sizes[I * 2 + 1]);
+			else
+				istm.skip((size_t)sizes[I * 2 + 1]);
+			columns_io<I + 1, N>::read(istm, rows, count, sizes, mask);
+		}
+	};
 
-		std::memcpy(reinterpret_cast<void*>(p), &m_arr[m_index], size);
+	template<size_t N>
+	struct columns_io<N, N>
+	{
+		template<typename Row>
+		static void header(const Row*, size_t, int*) {}
+		template<typename Stream, typename Row>
+		static void write(Stream&, const Row*, size_t) {}
+		template<typename Row>
+		static uint64_t check(size_t, const int*) { return 0; }
+		template<typename Stream, typename Rows>
+		static void read(Stream&, Rows&, size_t, const int*, uint64_t) {}
+	};
 
-		m_index += size;
-	}
+	template<typename T>
+	struct column_count : std::tuple_size<decltype(std::declval<T&>().simple_binstream_fields())> { };
+} // ns detail
 
-	void read(std::string& str, const unsigned int size)
+// Writes the rows as one columnar batch.
+template<typename Stream, typename T, typename A>
+void write_columnar(Stream& ostm, const std::vector<T, A>& rows)
+{
+	static_assert(detail::column_count<T>::value <= 64, "at most 64 columns");
+	const size_t N = detail::column_count<T>::value;
+
+	if (rows.size() > (size_t)INT_MAX)
+		throw std::runtime_error("Too many rows!");
+
+	int sizes[N * 2 + 1];
+	detail::columns_io<0, N>::header(rows.data(), rows.size(), sizes);
+
+	ostm << (int)rows.size() << (int)N;
+	write_array(ostm, sizes, N * 2);
+	detail::columns_io<0, N>::write(ostm, rows.data(), rows.size());
+}
+
+// Reads a columnar batch into rows, replacing their content. Fields whose
+// column is not in columns, a mask of column_bit(field index), are left
+// default constructed.
+template<typename Stream, typename T, typename A>
+void read_columnar(Stream& istm, std::vector<T, A>& rows, uint64_t columns = all_columns)
+{
+	static_assert(detail::column_count<T>::value <= 64, "at most 64 columns");
+	const size_t N = detail::column_count<T>::value;
+
+	int count = 0, column_count = 0;
+	istm >> count >> column_count;
+	if (count < 0 || column_count != (int)N)
+		throw std::runtime_error("Column type mismatch!");
+
+	int sizes[N * 2 + 1];
+	read_array(istm, sizes, N * 2);
+
+	// The count and sizes come from the data. A stream which knows its size
+	// must hold the columns before the rows are allocated; in others the
+	// rows grow as the first column read arrives.
+	uint64_t bytes = detail::columns_io<0, N>::template check<T>((size_t)count, sizes);
+	rows.clear();
+	rows.resize(detail::rows_up_front(istm, (size_t)count, bytes, detail::has_remaining<Stream>()));
+	detail::columns_io<0, N>::read(istm, rows, (size_t)count, sizes, columns);
+	// every column was skipped
+	if (!detail::stopped(istm))
+		rows.resize((size_t)count);
+}
+
+// zeroed bytes which memfile_istream keeps after the file data
+const size_t read_padding = 64;
+
+#ifdef SIMPLE_BINSTREAM_SPAN
+typedef std::span<const char> const_span;
+#else
+// the written bytes of an output stream, like std::span<const char>
+class const_span
+{
+public:
+	typedef char element_type;
+	typedef const char* iterator;
+
+	const_span() : m_data(nullptr), m_size(0) {}
+	const_span(const char* data, size_t size) : m_data(data), m_size(size) {}
+	const char* data() const
+	{
+		return m_data;
+	}
+	size_t size() const
+	{
+		return m_size;
+	}
+	bool empty() const
+	{
+		return m_size == 0;
+	}
+	const char& operator[](size_t i) const
+	{
+		return m_data[i];
+	}
+	iterator begin() const
+	{
+		return m_data;
+	}
+	iterator end() const
+	{
+		return m_data + m_size;
+	}
+private:
+	const char* m_data;
+	size_t m_size;
+};
+#endif
+
+namespace detail
+{
+	// Seeks and tells with 64-bit offsets, so files larger than 2 GB work
+	// where long is 32 bits. On 32-bit POSIX systems, off_t is only 64 bits
+	// when the program is built with -D_FILE_OFFSET_BITS=64.
+	inline int fseek64(std::FILE* fp, int64_t offset, int origin)
+	{
+#if defined(_MSC_VER)
+		return _fseeki64(fp, offset, origin);
+#elif defined(SIMPLE_BINSTREAM_POSIX)
+		return fseeko(fp, (off_t)offset, origin);
+#else
+		return std::fseek(fp, (long)offset, origin);
+#endif
+	}
+	inline int64_t ftell64(std::FILE* fp)
+	{
+#if defined(_MSC_VER)
+		return _ftelli64(fp);
+#elif defined(SIMPLE_BINSTREAM_POSIX)
+		return (int64_t)ftello(fp);
+#else
+		return (int64_t)std::ftell(fp);
+#endif
+	}
+	// the size of an open file, which is left positioned at the start
+	inline int64_t file_size64(std::FILE* fp)
+	{
+		fseek64(fp, 0, SEEK_END);
+		int64_t size = ftell64(fp);
+		fseek64(fp, 0, SEEK_SET);
+		return size;
+	}
+} // ns detail
+
+// Hints to the kernel on how a file stream uses the file, passed to the
+// constructor or open() of file_istream, memfile_istream and file_ostream.
+// They are ignored where the system has no such call.
+enum file_hint
+{
+	hint_none = 0,
+	// a larger readahead for a front to back scan (POSIX_FADV_SEQUENTIAL)
+	hint_sequential = 1,
+	// start reading the whole file into the page cache on open
+	// (readahead(2) on Linux, POSIX_FADV_WILLNEED elsewhere)
+	hint_willneed = 2,
+	// the data is read or written once (POSIX_FADV_NOREUSE)
+	hint_noreuse = 4,
+	// drop the file's pages from the page cache on close, so that a one-off
+	// scan does not evict the working set; an ostream first waits for its
+	// data to reach the disk
+	hint_dontneed = 8,
+	// file_ostream: write back every writeback_chunk bytes as they are
+	// written (sync_file_range on Linux), instead of in bursts; with
+	// hint_dontneed the pages written back are dropped along the way.
+	// After enable_async_flush(), the ostream ignores this hint and
+	// hint_dontneed.
+	hint_writeback = 16,
+	// uring_file_istream and uring_file_ostream: bypass the page cache
+	// with O_DIRECT, falling back to cached I/O where the file system
+	// refuses it
+	hint_direct = 32
+};
+
+// the interval of hint_writeback
+const size_t writeback_chunk = 8 << 20;
+
+namespace detail
+{
+#ifdef SIMPLE_BINSTREAM_FADVISE
+	inline void advise_open(int fd, int64_t size, unsigned hints)
+	{
+		if (hints & hint_sequential)
+			posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		if (hints & hint_noreuse)
+			posix_fadvise(fd, 0, 0, POSIX_FADV_NOREUSE);
+		if (hints & hint_willneed)
+		{
+#ifdef __linux__
+			readahead(fd, 0, (size_t)size);
+#else
+			posix_fadvise(fd, 0, (off_t)size, POSIX_FADV_WILLNEED);
+#endif
+		}
+	}
+	// drops the clean pages of a range, length 0 meaning to the end
+	inline void advise_drop(int fd, int64_t offset, int64_t length)
+	{
+		posix_fadvise(fd, (off_t)offset, (off_t)length, POSIX_FADV_DONTNEED);
+	}
+#endif
+	inline void advise_open(std::FILE* fp, int64_t size, unsigned hints)
+	{
+#ifdef SIMPLE_BINSTREAM_FADVISE
+		if (fp && hints != hint_none)
+			advise_open(fileno(fp), size, hints);
+#else
+		(void)fp; (void)size; (void)hints;
+#endif
+	}
+	inline void advise_drop(std::FILE* fp, int64_t offset, int64_t length)
+	{
+#ifdef SIMPLE_BINSTREAM_FADVISE
+		advise_drop(fileno(fp), offset, length);
+#else
+		(void)fp; (void)offset; (void)length;
+#endif
+	}
+} // ns detail
+
+// shared_buffer is an immutable block of bytes with a reference count, which
+// many shared_istreams, also on other threads, read without copying it. A
+// slice is a sub-range which keeps the whole block alive.
+class shared_buffer
+{
+public:
+	shared_buffer() : m_size(0), m_padding(0) {}
+	// copies the bytes
+	shared_buffer(const char * mem, size_t size) : m_size(size), m_padding(0)
+	{
+		char* p = new char[size];
+		if (size > 0)
+			std::memcpy(p, mem, size);
+		m_data.reset(p, std::default_delete<char[]>());
+	}
+	// takes over the vector without copying it
+	explicit shared_buffer(std::vector<char>&& vec) : m_size(vec.size()), m_padding(0)
+	{
+		std::shared_ptr<std::vector<char> > owner = std::make_shared<std::vector<char> >(std::move(vec));
+		m_data = std::shared_ptr<const char>(owner, owner->data());
+	}
+	// loads a whole file, followed by read_padding zeroed bytes; empty when
+	// the file cannot be read
+	static shared_buffer load(const char * file)
+	{
+		shared_buffer buf;
+#ifdef _MSC_VER
+		std::FILE* fp = nullptr;
+		fopen_s(&fp, file, "rb");
+#else
+		std::FILE* fp = std::fopen(file, "rb");
+#endif
+		if (!fp)
+			return buf;
+
+		size_t size = (size_t)detail::file_size64(fp);
+		char* p = new char[size + read_padding];
+		std::memset(p + size, 0, read_padding);
+		std::shared_ptr<const char> data(p, std::default_delete<char[]>());
+		bool ok = size == 0 || std::fread(p, size, 1, fp) == 1;
+		fclose(fp);
+		if (ok)
+		{
+			buf.m_data = data;
+			buf.m_size = size;
+			buf.m_padding = read_padding;
+		}
+		return buf;
+	}
+	const char* data() const
+	{
+		return m_data.get();
+	}
+	size_t size() const
+	{
+		return m_size;
+	}
+	bool empty() const
+	{
+		return m_size == 0;
+	}
+	// the readable bytes after the end, the rest of the block for a slice
+	size_t padding() const
+	{
+		return m_padding;
+	}
+	long use_count() const
+	{
+		return m_data.use_count();
+	}
+	shared_buffer slice(size_t offset, size_t size) const
+	{
+		if (offset > m_size || size > m_size - offset)
+			throw std::runtime_error("Invalid slice!");
+
+		shared_buffer buf;
+		buf.m_data = std::shared_ptr<const char>(m_data, m_data.get() + offset);
+		buf.m_size = size;
+		buf.m_padding = m_padding + (m_size - offset - size);
+		return buf;
+	}
+
+private:
+	std::shared_ptr<const char> m_data;
+	size_t m_size;
+	size_t m_padding;
+};
+
+// positional_file reads at a given offset without a file position of its
+// own, with pread on POSIX, so any number of threads read one open file at
+// once. positional_istream is the cursor on top of it.
+class positional_file
+{
+public:
+#ifdef SIMPLE_BINSTREAM_POSIX
+	positional_file() : m_fd(-1), m_size(0) {}
+	explicit positional_file(const char * file) : m_fd(-1), m_size(0)
+#else
+	positional_file() : m_fp(nullptr), m_size(0) {}
+	explicit positional_file(const char * file) : m_fp(nullptr), m_size(0)
+#endif
+	{
+		open(file);
+	}
+	~positional_file()
+	{
+		close();
+	}
+	bool open(const char * file)
+	{
+		close();
+#ifdef SIMPLE_BINSTREAM_POSIX
+		m_fd = ::open(file, O_RDONLY);
+		if (m_fd < 0)
+			return false;
+		struct stat st;
+		if (::fstat(m_fd, &st) != 0)
+		{
+			close();
+			return false;
+		}
+		m_size = (uint64_t)st.st_size;
+#else
+#ifdef _MSC_VER
+		fopen_s(&m_fp, file, "rb");
+#else
+		m_fp = std::fopen(file, "rb");
+#endif
+		if (!m_fp)
+			return false;
+		m_size = (uint64_t)detail::file_size64(m_fp);
+#endif
+		return true;
+	}
+	void close()
+	{
+#ifdef SIMPLE_BINSTREAM_POSIX
+		if (m_fd >= 0)
+		{
+			::close(m_fd);
+			m_fd = -1;
+		}
+#else
+		if (m_fp)
+		{
+			fclose(m_fp);
+			m_fp = nullptr;
+		}
+#endif
+		m_size = 0;
+	}
+	bool is_open() const
+	{
+#ifdef SIMPLE_BINSTREAM_POSIX
+		return m_fd >= 0;
+#else
+		return m_fp != nullptr;
+#endif
+	}
+	uint64_t size() const
+	{
+		return m_size;
+	}
+	// reads all size bytes at offset; thread-safe
+	bool read_at(uint64_t offset, char* p, size_t size) const
+	{
+#ifdef SIMPLE_BINSTREAM_POSIX
+		while (size > 0)
+		{
+			ssize_t n = ::pread(m_fd, p, size, (off_t)offset);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return false;
+			p += n;
+			size -= (size_t)n;
+			offset += (uint64_t)n;
+		}
+		return true;
+#else
+		// stdio has no positional read; the seek and the read are done under a lock
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (detail::fseek64(m_fp, (int64_t)offset, SEEK_SET) != 0)
+			return false;
+		return size == 0 || std::fread(p, size, 1, m_fp) == 1;
+#endif
+	}
+
+private:
+	positional_file(const positional_file&);
+	positional_file& operator=(const positional_file&);
+
+#ifdef SIMPLE_BINSTREAM_POSIX
+	int m_fd;
+#else
+	std::FILE* m_fp;
+	mutable std::mutex m_mutex;
+#endif
+	uint64_t m_size;
+};
+
+// The file and memory streams are built from one core for reading and one
+// for writing, which hold the typed reads and writes, endian swapping,
+// skipping and peeking, so an improvement there reaches every stream. What
+// differs is where the bytes come from or go to: a source policy for the
+// istream core and a sink policy for the ostream core. The byte order stays
+// the same_endian_type parameter. file_istream, mem_istream and the other
+// classic names are aliases of the cores with their policy, and so are the
+// io_uring streams. chunk_istream and the coroutine streams are not: a
+// chunk_istream read comes up short without throwing, and a coroutine read
+// suspends.
+//
+// A source provides fetch(p, size) and discard(size), which return false
+// when fewer bytes remain, look(p, size) which copies without moving, eof()
+// and fail(), which throws the stream's error. A source which knows its size
+// also provides remaining(), so that a corrupt length is caught before it is
+// allocated. Sources over one block of memory also provide has(size),
+// cursor() and advance(size) for the unchecked reads.
+template<typename Source, typename same_endian_type>
+class basic_bin_istream : public Source
+{
+public:
+	typedef istream_tag stream_category;
+	typedef same_endian_type endian_type;
+
+	basic_bin_istream() {}
+	// the arguments are passed on to the source; a stream of the same type
+	// is copied by the copy constructor instead
+	template<typename Arg, typename... Args, typename = typename std::enable_if<!std::is_base_of<basic_bin_istream, typename std::decay<Arg>::type>::value>::type>
+	basic_bin_istream(Arg&& arg, Args&&... args) : Source(std::forward<Arg>(arg), std::forward<Args>(args)...) {}
+
+	template<typename T>
+	void read(T& t)
+	{
+		if (!this->fetch(reinterpret_cast<char*>(&t), sizeof(T)))
+			this->fail();
+
+		simple::swap_endian_if_same_endian_is_false(t, m_same_type);
+	}
+	void read(typename std::vector<char>& vec)
+	{
+		read(vec.data(), vec.size());
+	}
+	void read(char* p, size_t size)
+	{
+		if (size > 0 && !this->fetch(p, size))
+			this->fail();
+	}
+	void read(std::string& str, const unsigned int size)
+	{
+		str.clear();
+		detail::read_string(*this, str, size);
+	}
+	// throws when fewer than size bytes are left; for a source with remaining()
+	void require(uint64_t size) const
+	{
+		if (size > this->remaining())
+			this->fail();
+	}
+
+	void skip(size_t size)
+	{
+		if (!this->discard(size))
+			this->fail();
+	}
+	template<typename T>
+	void skip()
+	{
+		static_assert(is_bitwise_serializable<T>::value, "use skip_string() for strings");
+		skip(sizeof(T));
+	}
+	// steps over a string by its length prefix, without allocating it
+	void skip_string()
+	{
+		int size = 0;
+		read(size);
+		if (size > 0)
+			skip((size_t)size);
+	}
+	// returns the next value without moving past it
+	template<typename T>
+	T peek()
+	{
+		T t;
+		if (!this->look(reinterpret_cast<char*>(&t), sizeof(T)))
+			this->fail();
+
+		simple::swap_endian_if_same_endian_is_false(t, m_same_type);
+		return t;
+	}
+
+	// Checks once that size bytes remain, for the read_unchecked() calls that follow.
+	void ensure(size_t size) const
+	{
+		if (!this->has(size))
+			this->fail();
+	}
+	// Reads without bounds checks, within a window validated by ensure() or,
+	// for a record no longer than padding(), followed by check().
+	template<typename T>
+	void read_unchecked(T& t)
+	{
+		std::memcpy(reinterpret_cast<void*>(&t), this->cursor(), sizeof(T));
+		this->advance(sizeof(T));
+
+		simple::swap_endian_if_same_endian_is_false(t, m_same_type);
+	}
+	void read_unchecked(char* p, size_t size)
+	{
+		std::memcpy(reinterpret_cast<void*>(p), this->cursor(), size);
+		this->advance(size);
+	}
+	// throws when unchecked reads went past the end
+	void check() const
+	{
+		if (!this->has(0))
+			this->fail();
+	}
+
+private:
+	same_endian_type m_same_type;
+};
+
+namespace detail
+{
+	// reads from a block of memory which is owned elsewhere
+	class memory_source
+	{
+	public:
+		memory_source() : m_arr(nullptr), m_size(0), m_index(0), m_padding(0) {}
+
+		bool eof() const
+		{
+			return m_index >= m_size;
+		}
+		// the bytes left to read
+		uint64_t remaining() const
+		{
+			return (m_index < m_size) ? m_size - m_index : 0;
+		}
+		std::ifstream::pos_type tellg() const
+		{
+			return m_index;
+		}
+		bool seekg(size_t pos)
+		{
+			if (pos < m_size)
+				m_index = pos;
+			else
+				return false;
+
+			return true;
+		}
+		bool seekg(std::streamoff offset, std::ios_base::seekdir way)
+		{
+			if (way == std::ios_base::beg && (size_t)offset < m_size)
+				m_index = offset;
+			else if (way == std::ios_base::cur && (m_index + offset) < m_size)
+				m_index += offset;
+			else if (way == std::ios_base::end && (m_size + offset) < m_size)
+				m_index = m_size + offset;
+			else
+				return false;
+
+			return true;
+		}
+		// the readable bytes after the end of the data
+		size_t padding() const
+		{
+			return m_padding;
+		}
+
+	protected:
+		bool fetch(char* p, size_t size)
+		{
+			if ((m_index + size) > m_size)
+				return false;
+
+			std::memcpy(reinterpret_cast<void*>(p), m_arr + m_index, size);
+			m_index += size;
+			return true;
+		}
+		bool discard(size_t size)
+		{
+			if ((m_index + size) > m_size)
+				return false;
+
+			m_index += size;
+			return true;
+		}
+		bool look(char* p, size_t size) const
+		{
+			if ((m_index + size) > m_size)
+				return false;
+
+			std::memcpy(reinterpret_cast<void*>(p), m_arr + m_index, size);
+			return true;
+		}
+		bool has(size_t size) const
+		{
+			return (m_index + size) <= m_size;
+		}
+		const char* cursor() const
+		{
+			return m_arr + m_index;
+		}
+		void advance(size_t size)
+		{
+			m_index += size;
+		}
+		void fail() const
+		{
+			throw std::runtime_error("Premature end of array!");
+		}
+		void reset(const char* mem, size_t size, size_t padding)
+		{
+			m_arr = mem;
+			m_size = size;
+			m_index = 0;
+			m_padding = padding;
+		}
+
+		const char* m_arr;
+		size_t m_size;
+		size_t m_index;
+		size_t m_padding;
+	};
+
+	// reads from its own copy of the data
+	template<typename Allocator>
+	class vector_source : public memory_source
+	{
+	public:
+		typedef Allocator allocator_type;
+		typedef std::vector<char, Allocator> buffer_type;
+
+		explicit vector_source(const Allocator& alloc = Allocator()) : m_vec(alloc) {}
+		vector_source(const char * mem, size_t size, const Allocator& alloc = Allocator()) : m_vec(alloc)
+		{
+			open(mem, size);
+		}
+		template<typename VecAllocator>
+		vector_source(const std::vector<char, VecAllocator>& vec, const Allocator& alloc = Allocator()) : m_vec(alloc)
+		{
+			open(vec.data(), vec.size());
+		}
+		vector_source(const vector_source& other) : memory_source(other), m_vec(other.m_vec)
+		{
+			m_arr = m_vec.data();
+		}
+		vector_source& operator=(const vector_source& other)
+		{
+			memory_source::operator=(other);
+			m_vec = other.m_vec;
+			m_arr = m_vec.data();
+			return *this;
+		}
+		void open(const char * mem, size_t size)
+		{
+			m_vec.clear();
+			m_vec.reserve(size);
+			m_vec.assign(mem, mem + size);
+			reset(m_vec.data(), m_vec.size(), 0);
+		}
+		void close()
+		{
+			m_vec.clear();
+			reset(m_vec.data(), 0, 0);
+		}
+		const buffer_type& get_internal_vec() const
+		{
+			return m_vec;
+		}
+		const char* data() const
+		{
+			return m_vec.data();
+		}
+		size_t size() const
+		{
+			return m_vec.size();
+		}
+
+	private:
+		buffer_type m_vec;
+	};
+
+	// reads from memory which the caller keeps alive
+	class pointer_source : public memory_source
+	{
+	public:
+		pointer_source() {}
+		// padding is the number of bytes after the end which the caller
+		// guarantees to be readable, for read_unchecked() followed by check()
+		pointer_source(const char * mem, size_t size, size_t padding = 0)
+		{
+			open(mem, size, padding);
+		}
+		template<typename VecAllocator>
+		pointer_source(const std::vector<char, VecAllocator>& vec)
+		{
+			open(vec.data(), vec.size());
+		}
+		void open(const char * mem, size_t size, size_t padding = 0)
+		{
+			reset(mem, size, padding);
+		}
+		void close()
+		{
+			reset(nullptr, 0, 0);
+		}
+	};
+
+	// reads from a shared_buffer, which the copies of the stream share
+	class shared_source : public memory_source
+	{
+	public:
+		shared_source() {}
+		shared_source(const shared_buffer& buf)
+		{
+			open(buf);
+		}
+		void open(const shared_buffer& buf)
+		{
+			m_buf = buf;
+			reset(buf.data(), buf.size(), buf.padding());
+		}
+		void close()
+		{
+			m_buf = shared_buffer();
+			reset(nullptr, 0, 0);
+		}
+		const shared_buffer& buffer() const
+		{
+			return m_buf;
+		}
+
+	private:
+		shared_buffer m_buf;
+	};
+
+	// reads a positional_file from its own offset, through a buffer of its own
+	class positional_source
+	{
+	public:
+		positional_source() : m_file(nullptr), m_offset(0), m_size(0), m_pos(0), m_len(0) {}
+		// buffer_size is the size of the reads from the file; keep it small
+		// for lookups of single records
+		positional_source(const positional_file& file, uint64_t offset = 0, size_t buffer_size = 4096)
+			: m_file(nullptr), m_offset(0), m_size(0), m_pos(0), m_len(0)
+		{
+			open(file, offset, buffer_size);
+		}
+		void open(const positional_file& file, uint64_t offset = 0, size_t buffer_size = 4096)
+		{
+			m_file = &file;
+			m_size = file.size();
+			m_offset = offset;
+			m_buf.resize(buffer_size);
+			m_pos = m_len = 0;
+		}
+		void close()
+		{
+			m_file = nullptr;
+			m_offset = m_size = 0;
+			m_pos = m_len = 0;
+		}
+		bool eof() const
+		{
+			return m_offset >= m_size;
+		}
+		uint64_t remaining() const
+		{
+			return (m_offset < m_size) ? m_size - m_offset : 0;
+		}
+		uint64_t tellg() const
+		{
+			return m_offset;
+		}
+		bool seekg(uint64_t pos)
+		{
+			if (pos >= m_size)
+				return false;
+
+			// the buffer is kept when pos is inside it
+			uint64_t start = m_offset - m_pos;
+			if (pos >= start && pos < start + m_len)
+				m_pos = (size_t)(pos - start);
+			else
+				m_pos = m_len = 0;
+			m_offset = pos;
+			return true;
+		}
+
+	protected:
+		bool fetch(char* p, size_t size)
+		{
+			if (size <= m_len - m_pos)
+			{
+				std::memcpy(reinterpret_cast<void*>(p), &m_buf[m_pos], size);
+				m_pos += size;
+				m_offset += size;
+				return true;
+			}
+			return fetch_more(p, size);
+		}
+		bool discard(size_t size)
+		{
+			if (size <= m_len - m_pos)
+			{
+				m_pos += size;
+				m_offset += size;
+				return true;
+			}
+			if (size > m_size - m_offset)
+				return false;
+
+			m_offset += size;
+			m_pos = m_len = 0;
+			return true;
+		}
+		bool look(char* p, size_t size)
+		{
+			if (size <= m_len - m_pos)
+			{
+				std::memcpy(reinterpret_cast<void*>(p), &m_buf[m_pos], size);
+				return true;
+			}
+			return size <= m_size - m_offset && m_file->read_at(m_offset, p, size);
+		}
+		void fail() const
+		{
+			throw std::runtime_error("Read Error!");
+		}
+
+	private:
+		bool fetch_more(char* p, size_t size)
+		{
+			if (m_offset > m_size || size > m_size - m_offset)
+				return false;
+
+			size_t have = m_len - m_pos;
+			if (have > 0)
+				std::memcpy(reinterpret_cast<void*>(p), &m_buf[m_pos], have);
+			p += have;
+			size -= have;
+			m_offset += have;
+			m_pos = m_len = 0;
+
+			// a large value goes straight into place
+			if (size >= m_buf.size())
+			{
+				if (!m_file->read_at(m_offset, p, size))
+					return false;
+				m_offset += size;
+				return true;
+			}
+			size_t len = (size_t)std::min<uint64_t>(m_buf.size(), m_size - m_offset);
+			if (!m_file->read_at(m_offset, &m_buf[0], len))
+				return false;
+			m_len = len;
+			std::memcpy(reinterpret_cast<void*>(p), &m_buf[0], size);
+			m_pos = size;
+			m_offset += size;
+			return true;
+		}
+
+		const positional_file* m_file;
+		uint64_t m_offset;
+		uint64_t m_size;
+		std::vector<char> m_buf;
+		size_t m_pos;
+		size_t m_len;
+	};
+
+	// reads from a whole file loaded into memory, followed by read_padding zeroed bytes
+	class file_buffer_source : public memory_source
+	{
+	public:
+		file_buffer_source() : m_buf(nullptr) {}
+		// hints is a combination of file_hint values, applied while loading
+		file_buffer_source(const char * file, unsigned hints = hint_none) : m_buf(nullptr)
+		{
+			open(file, hints);
+		}
+#ifdef _MSC_VER
+		file_buffer_source(const wchar_t * file, unsigned hints = hint_none) : m_buf(nullptr)
+		{
+			open(file, hints);
+		}
+#endif
+		~file_buffer_source()
+		{
+			close();
+		}
+		void open(const char * file, unsigned hints = hint_none)
+		{
+			close();
+#ifdef _MSC_VER
+			std::FILE* input_file_ptr = nullptr;
+			fopen_s(&input_file_ptr, file, "rb");
+#else
+			std::FILE* input_file_ptr = std::fopen(file, "rb");
+#endif
+			load(input_file_ptr, hints);
+		}
+#ifdef _MSC_VER
+		void open(const wchar_t * file, unsigned hints = hint_none)
+		{
+			close();
+			std::FILE* input_file_ptr = nullptr;
+			_wfopen_s(&input_file_ptr, file, L"rb");
+			load(input_file_ptr, hints);
+		}
+#endif
+		void close()
+		{
+			if (m_buf)
+			{
+				delete[] m_buf;
+				m_buf = nullptr;
+				reset(nullptr, 0, 0);
+			}
+		}
+		bool is_open()
+		{
+			return (m_buf != nullptr);
+		}
+		int64_t file_length() const
+		{
+			return (int64_t)m_size;
+		}
+
+	private:
+		file_buffer_source(const file_buffer_source&);
+		file_buffer_source& operator=(const file_buffer_source&);
+
+		void load(std::FILE* input_file_ptr, unsigned hints)
+		{
+			if (!input_file_ptr)
+				return;
+
+			size_t size = (size_t)file_size64(input_file_ptr);
+			advise_open(input_file_ptr, (int64_t)size, hints);
+			m_buf = new char[size + read_padding];
+			std::memset(m_buf + size, 0, read_padding);
+			std::fread(m_buf, size, 1, input_file_ptr);
+			// the data is in memory now, the cached pages are not needed
+			if (hints & hint_dontneed)
+				advise_drop(input_file_ptr, 0, 0);
+			fclose(input_file_ptr);
+			reset(m_buf, size, read_padding);
+		}
+
+		char* m_buf;
+	};
+
+	// reads across a sequence of buffers, e.g. network buffers or the parts
+	// of a split file, without joining them
+	class segment_source
+	{
+	public:
+		segment_source() : m_seg(0), m_pos(0), m_offset(0), m_size(0) {}
+		// appends a buffer which the caller keeps alive
+		void add(const char * mem, size_t size)
+		{
+			if (size > 0)
+			{
+				m_segs.push_back(const_span(mem, size));
+				m_size += size;
+			}
+		}
+		// appends a whole file, loaded into a buffer of its own
+		bool add_file(const char * file)
+		{
+#ifdef _MSC_VER
+			std::FILE* fp = nullptr;
+			fopen_s(&fp, file, "rb");
+#else
+			std::FILE* fp = std::fopen(file, "rb");
+#endif
+			if (!fp)
+				return false;
+
+			size_t size = (size_t)file_size64(fp);
+			std::vector<char> buf(size);
+			bool ok = size == 0 || std::fread(buf.data(), size, 1, fp) == 1;
+			fclose(fp);
+			if (!ok)
+				return false;
+
+			// moving the vector keeps its data where it is
+			m_files.push_back(std::move(buf));
+			add(m_files.back().data(), size);
+			return true;
+		}
+		void close()
+		{
+			m_segs.clear();
+			m_files.clear();
+			m_seg = m_pos = m_offset = m_size = 0;
+		}
+		size_t segment_count() const
+		{
+			return m_segs.size();
+		}
+		// the total size of the segments
+		size_t size() const
+		{
+			return m_size;
+		}
+		bool eof() const
+		{
+			return m_offset >= m_size;
+		}
+		uint64_t remaining() const
+		{
+			return (m_offset < m_size) ? m_size - m_offset : 0;
+		}
+		std::ifstream::pos_type tellg() const
+		{
+			return m_offset;
+		}
+		bool seekg(size_t pos)
+		{
+			if (pos >= m_size)
+				return false;
+
+			m_offset = pos;
+			m_seg = 0;
+			while (pos >= m_segs[m_seg].size())
+			{
+				pos -= m_segs[m_seg].size();
+				++m_seg;
+			}
+			m_pos = pos;
+			return true;
+		}
+
+	protected:
+		bool fetch(char* p, size_t size)
+		{
+			if (m_seg < m_segs.size() && size <= m_segs[m_seg].size() - m_pos)
+			{
+				std::memcpy(reinterpret_cast<void*>(p), m_segs[m_seg].data() + m_pos, size);
+				m_pos += size;
+				m_offset += size;
+				return true;
+			}
+			return stitch(p, size);
+		}
+		bool discard(size_t size)
+		{
+			return stitch(nullptr, size);
+		}
+		bool look(char* p, size_t size)
+		{
+			size_t seg = m_seg, pos = m_pos, offset = m_offset;
+			bool ok = fetch(p, size);
+			m_seg = seg;
+			m_pos = pos;
+			m_offset = offset;
+			return ok;
+		}
+		void fail() const
+		{
+			throw std::runtime_error("Premature end of array!");
+		}
+
+	private:
+		// copies a value which straddles segments piece by piece, or steps
+		// over it when p is null
+		bool stitch(char* p, size_t size)
+		{
+			if (size > m_size - m_offset)
+				return false;
+
+			m_offset += size;
+			while (size > 0)
+			{
+				size_t room = m_segs[m_seg].size() - m_pos;
+				if (room == 0)
+				{
+					++m_seg;
+					m_pos = 0;
+					continue;
+				}
+				size_t n = std::min(room, size);
+				if (p)
+				{
+					std::memcpy(reinterpret_cast<void*>(p), m_segs[m_seg].data() + m_pos, n);
+					p += n;
+				}
+				m_pos += n;
+				size -= n;
+			}
+			return true;
+		}
+
+		// m_segs points into m_files, so a copy would read the original's buffers
+		segment_source(const segment_source&);
+		segment_source& operator=(const segment_source&);
+
+		std::vector<const_span> m_segs;
+		std::vector<std::vector<char> > m_files;
+		size_t m_seg;
+		size_t m_pos;
+		size_t m_offset;
+		size_t m_size;
+	};
+
+	// Reads a file on a background thread into count blocks of block_size
+	// bytes, which it keeps filled ahead of the reads. The blocks go round a
+	// ring: the thread fills them in turn and the reader takes them in turn,
+	// each side moving only its own atomic counter, so neither takes a lock
+	// while the other keeps up. A side which has to wait sleeps on a
+	// condition variable, and the other side wakes it only then.
+	class prefetch_source
+	{
+	public:
+		prefetch_source() : m_fp(nullptr), m_size(0), m_offset(0), m_block_size(0), m_hints(hint_none),
+			m_data(nullptr), m_pos(0), m_len(0), m_waits(0), m_filled(0), m_taken(0),
+			m_stop(false), m_done(false), m_reader_waiting(false), m_writer_waiting(false) {}
+		// hints is a combination of file_hint values
+		prefetch_source(const char * file, size_t block_size = 1 << 20, unsigned count = 4, unsigned hints = hint_none)
+			: m_fp(nullptr), m_size(0), m_offset(0), m_block_size(0), m_hints(hint_none),
+			m_data(nullptr), m_pos(0), m_len(0), m_waits(0), m_filled(0), m_taken(0),
+			m_stop(false), m_done(false), m_reader_waiting(false), m_writer_waiting(false)
+		{
+			open(file, block_size, count, hints);
+		}
+		~prefetch_source()
+		{
+			close();
+		}
+		void open(const char * file, size_t block_size = 1 << 20, unsigned count = 4, unsigned hints = hint_none)
+		{
+			close();
+#ifdef _MSC_VER
+			fopen_s(&m_fp, file, "rb");
+#else
+			m_fp = std::fopen(file, "rb");
+#endif
+			if (!m_fp)
+				return;
+			// the blocks are the buffer
+			std::setvbuf(m_fp, nullptr, _IONBF, 0);
+			m_size = file_size64(m_fp);
+			m_hints = hints;
+			advise_open(m_fp, m_size, m_hints);
+			m_block_size = block_size ? block_size : 1;
+			// one block is read from while the others are filled
+			m_blocks.assign(count < 2 ? 2 : count, std::vector<char>(m_block_size));
+			m_lens.assign(m_blocks.size(), 0);
+			start(0);
+		}
+		void close()
+		{
+			stop();
+			if (m_fp)
+			{
+				if (m_hints & hint_dontneed)
+					advise_drop(m_fp, 0, 0);
+				fclose(m_fp);
+				m_fp = nullptr;
+			}
+			m_blocks.clear();
+			m_lens.clear();
+			m_size = m_offset = 0;
+			m_waits = 0;
+		}
+		bool is_open() const
+		{
+			return m_fp != nullptr;
+		}
+		int64_t file_length() const
+		{
+			return m_size;
+		}
+		bool eof() const
+		{
+			return m_offset >= m_size;
+		}
+		uint64_t remaining() const
+		{
+			return (m_offset < m_size) ? (uint64_t)(m_size - m_offset) : 0;
+		}
+		int64_t tellg() const
+		{
+			return m_offset;
+		}
+		// within the current block the thread goes on; elsewhere it is
+		// restarted at pos
+		bool seekg(int64_t pos)
+		{
+			if (!m_fp || pos < 0 || pos >= m_size)
+				return false;
+
+			int64_t start_of_block = m_offset - (int64_t)m_pos;
+			if (m_data && pos >= start_of_block && pos < start_of_block + (int64_t)m_len)
+			{
+				m_pos = (size_t)(pos - start_of_block);
+				m_offset = pos;
+				return true;
+			}
+			stop();
+			start(pos);
+			return true;
+		}
+		// the number of times a read waited for the thread to fill a block;
+		// it stays low while the disk keeps up with the decoding
+		uint64_t waits() const
+		{
+			return m_waits;
+		}
+
+	protected:
+		bool fetch(char* p, size_t size)
+		{
+			if (size <= m_len - m_pos)
+			{
+				std::memcpy(reinterpret_cast<void*>(p), m_data + m_pos, size);
+				m_pos += size;
+				m_offset += size;
+				return true;
+			}
+			return stitch(p, size);
+		}
+		bool discard(size_t size)
+		{
+			// a skip past the blocks in the ring restarts the thread instead of reading through
+			if (size > (m_len - m_pos) + m_block_size * m_blocks.size() && m_offset + (int64_t)size < m_size)
+				return seekg(m_offset + (int64_t)size);
+
+			return stitch(nullptr, size);
+		}
+		bool look(char* p, size_t size)
+		{
+			size_t have = m_len - m_pos;
+			if (size <= have)
+			{
+				std::memcpy(reinterpret_cast<void*>(p), m_data + m_pos, size);
+				return true;
+			}
+			if (m_offset > m_size || (uint64_t)size > (uint64_t)(m_size - m_offset))
+				return false;
+
+			const uint64_t count = m_blocks.size();
+			// more than the ring holds ahead of the reader
+			if ((uint64_t)(size - have) > (count - (m_data ? 1 : 0)) * (uint64_t)m_block_size)
+				return look_direct(p, size);
+
+			if (have > 0)
+				std::memcpy(reinterpret_cast<void*>(p), m_data + m_pos, have);
+			// the rest is in the blocks after the current one, which are not given back
+			uint64_t taken = m_taken.load(std::memory_order_relaxed);
+			uint64_t next = taken + (m_data ? 1 : 0);
+			for (size_t done = have; done < size; ++next)
+			{
+				if (next - taken >= count)
+					return false;
+				if (m_filled.load(std::memory_order_acquire) <= next && !wait_filled(next + 1))
+					return false;
+
+				size_t i = (size_t)(next % count);
+				size_t n = std::min(m_lens[i], size - done);
+				std::memcpy(reinterpret_cast<void*>(p + done), m_blocks[i].data(), n);
+				done += n;
+			}
+			return true;
+		}
+		void fail() const
+		{
+			throw std::runtime_error("Read Error!");
+		}
+
+	private:
+		prefetch_source(const prefetch_source&);
+		prefetch_source& operator=(const prefetch_source&);
+
+		void start(int64_t pos)
+		{
+			m_offset = pos;
+			m_data = nullptr;
+			m_pos = m_len = 0;
+			m_filled = 0;
+			m_taken = 0;
+			m_stop = false;
+			m_done = false;
+			if (fseek64(m_fp, pos, SEEK_SET) == 0)
+				m_thread = std::thread(&prefetch_source::run, this);
+			else
+				m_done = true;
+		}
+		void stop()
+		{
+			if (!m_thread.joinable())
+				return;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stop = true;
+			}
+			m_cond.notify_all();
+			m_thread.join();
+		}
+		// the background thread
+		void run()
+		{
+			const uint64_t count = m_blocks.size();
+			uint64_t filled = 0;
+			while (!m_stop.load(std::memory_order_relaxed))
+			{
+				if (filled - m_taken.load(std::memory_order_acquire) >= count)
+				{
+					// every block is ahead of the reader
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_writer_waiting = true;
+					m_cond.wait(lock, [&] { return m_stop.load() || filled - m_taken.load() < count; });
+					m_writer_waiting = false;
+					continue;
+				}
+				size_t i = (size_t)(filled % count);
+				size_t len = std::fread(m_blocks[i].data(), 1, m_block_size, m_fp);
+				if (len > 0)
+				{
+					m_lens[i] = len;
+					m_filled.store(++filled);
+					wake(m_reader_waiting);
+				}
+				// the end of the file, or a read error which the reader sees as the end
+				if (len < m_block_size)
+					break;
+			}
+			m_done.store(true);
+			wake(m_reader_waiting);
+		}
+		// A waiter sets its flag before it checks the other side's counter,
+		// and the other side checks the flag after it moves the counter, so
+		// one of them sees the other and no wakeup is lost.
+		void wake(std::atomic<bool>& waiting)
+		{
+			if (waiting.load())
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_cond.notify_all();
+			}
+		}
+		// waits until n blocks were filled; false when the thread ended first
+		bool wait_filled(uint64_t n)
+		{
+			++m_waits;
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_reader_waiting = true;
+			m_cond.wait(lock, [&] { return m_filled.load() >= n || m_done.load(); });
+			m_reader_waiting = false;
+			return m_filled.load() >= n;
+		}
+		// gives the current block back to the thread and takes the next one
+		bool next_block()
+		{
+			uint64_t taken = m_taken.load(std::memory_order_relaxed);
+			if (m_data)
+			{
+				m_data = nullptr;
+				m_pos = m_len = 0;
+				m_taken.store(++taken);
+				wake(m_writer_waiting);
+			}
+			if (m_filled.load(std::memory_order_acquire) <= taken && !wait_filled(taken + 1))
+				return false;
+
+			size_t i = (size_t)(taken % m_blocks.size());
+			m_data = m_blocks[i].data();
+			m_len = m_lens[i];
+			m_pos = 0;
+			return true;
+		}
+		// reads from the file itself, with the thread stopped since it shares
+		// the file position, and restarts the thread where the reader is
+		bool look_direct(char* p, size_t size)
+		{
+			int64_t pos = m_offset;
+			stop();
+			bool ok = fseek64(m_fp, pos, SEEK_SET) == 0 && std::fread(p, size, 1, m_fp) == 1;
+			start(pos);
+			return ok;
+		}
+		// copies a value which straddles blocks piece by piece, or steps
+		// over it when p is null
+		bool stitch(char* p, size_t size)
+		{
+			if (m_offset > m_size || (uint64_t)size > (uint64_t)(m_size - m_offset))
+				return false;
+
+			while (size > 0)
+			{
+				if (m_pos == m_len && !next_block())
+					return false;
+
+				size_t n = std::min(m_len - m_pos, size);
+				if (p)
+				{
+					std::memcpy(reinterpret_cast<void*>(p), m_data + m_pos, n);
+					p += n;
+				}
+				m_pos += n;
+				m_offset += n;
+				size -= n;
+			}
+			return true;
+		}
+
+		std::FILE* m_fp;
+		int64_t m_size;
+		int64_t m_offset;
+		size_t m_block_size;
+		unsigned m_hints;
+		std::vector<std::vector<char> > m_blocks;
+		std::vector<size_t> m_lens;
+		// the block being read
+		const char* m_data;
+		size_t m_pos;
+		size_t m_len;
+		uint64_t m_waits;
+		// blocks filled by the thread and blocks given back by the reader
+		std::atomic<uint64_t> m_filled;
+		std::atomic<uint64_t> m_taken;
+		std::atomic<bool> m_stop;
+		std::atomic<bool> m_done;
+		std::atomic<bool> m_reader_waiting;
+		std::atomic<bool> m_writer_waiting;
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+		std::thread m_thread;
+	};
+
+	// reads through stdio
+	class file_source
+	{
+	public:
+		file_source() : input_file_ptr(nullptr), file_size(0), read_length(0), m_hints(hint_none), m_ahead_pos(0) {}
+		// hints is a combination of file_hint values
+		file_source(const char * file, unsigned hints = hint_none) : input_file_ptr(nullptr), file_size(0), read_length(0), m_hints(hint_none), m_ahead_pos(0)
+		{
+			open(file, hints);
+		}
+#ifdef _MSC_VER
+		file_source(const wchar_t * file, unsigned hints = hint_none) : input_file_ptr(nullptr), file_size(0), read_length(0), m_hints(hint_none), m_ahead_pos(0)
+		{
+			open(file, hints);
+		}
+#endif
+		~file_source()
+		{
+			close();
+		}
+		void open(const char * file, unsigned hints = hint_none)
+		{
+			close();
+#ifdef _MSC_VER
+			input_file_ptr = nullptr;
+			fopen_s(&input_file_ptr, file, "rb");
+#else
+			input_file_ptr = std::fopen(file, "rb");
+#endif
+			compute_length();
+			m_hints = hints;
+			advise_open(input_file_ptr, file_size, m_hints);
+		}
+#ifdef _MSC_VER
+		void open(const wchar_t * file, unsigned hints = hint_none)
+		{
+			close();
+			input_file_ptr = nullptr;
+			_wfopen_s(&input_file_ptr, file, L"rb");
+			compute_length();
+			m_hints = hints;
+			advise_open(input_file_ptr, file_size, m_hints);
+		}
+#endif
+		void close()
+		{
+			if (input_file_ptr)
+			{
+				if (m_hints & hint_dontneed)
+					advise_drop(input_file_ptr, 0, 0);
+				fclose(input_file_ptr);
+				input_file_ptr = nullptr;
+			}
+			m_ahead.clear();
+			m_ahead_pos = 0;
+		}
+		bool is_open()
+		{
+			return (input_file_ptr != nullptr);
+		}
+		int64_t file_length() const
+		{
+			return file_size;
+		}
+		// http://www.cplusplus.com/reference/cstdio/feof/
+		// stream's internal position indicator may point to the end-of-file for the 
+		// next operation, but still, the end-of-file indicator may not be set until 
+		// an operation attempts to read at that point.
+		bool eof() const // not using feof(), see above
+		{
+			return read_length >= file_size;
+		}
+		uint64_t remaining() const
+		{
+			return (read_length < file_size) ? (uint64_t)(file_size - read_length) : 0;
+		}
+		int64_t tellg() const
+		{
+			return ftell64(input_file_ptr) - (int64_t)ahead();
+		}
+		void seekg (int64_t pos)
+		{
+			drop_ahead(ahead());
+			fseek64(input_file_ptr, pos, SEEK_SET);
+			read_length = pos;
+		}
+		void seekg (int64_t offset, int way)
+		{
+			// the file is ahead of the stream by what look() has buffered
+			fseek64(input_file_ptr, way == SEEK_CUR ? offset - (int64_t)ahead() : offset, way);
+			drop_ahead(ahead());
+			if (way == SEEK_END)
+				read_length = file_size - offset;
+			else if (way == SEEK_CUR)
+				read_length += offset;
+			else
+				read_length = offset;
+		}
+
+	protected:
+		bool fetch(char* p, size_t size)
+		{
+			size_t n = std::min(size, ahead());
+			if (n > 0)
+			{
+				std::memcpy(reinterpret_cast<void*>(p), &m_ahead[m_ahead_pos], n);
+				drop_ahead(n);
+			}
+			if (n < size && std::fread(reinterpret_cast<void*>(p + n), size - n, 1, input_file_ptr) != 1)
+				return false;
+
+			read_length += size;
+			return true;
+		}
+		bool discard(size_t size)
+		{
+			if (read_length + (int64_t)size > file_size)
+				return false;
+
+			size_t n = std::min(size, ahead());
+			drop_ahead(n);
+			size_t rest = size - n;
+
+			// fseek drops the stdio buffer, so short skips are read through it instead
+			char scratch[256];
+			if (rest <= sizeof(scratch))
+			{
+				if (rest > 0 && std::fread(scratch, rest, 1, input_file_ptr) != 1)
+					return false;
+			}
+			else if (fseek64(input_file_ptr, (int64_t)rest, SEEK_CUR) != 0)
+				return false;
+
+			read_length += size;
+			return true;
+		}
+		// the bytes are kept in m_ahead for the next fetch, as seeking back
+		// would drop the stdio buffer on every peek
+		bool look(char* p, size_t size)
+		{
+			if (ahead() < size)
+			{
+				if (m_ahead_pos > 0)
+				{
+					m_ahead.erase(m_ahead.begin(), m_ahead.begin() + m_ahead_pos);
+					m_ahead_pos = 0;
+				}
+				size_t have = m_ahead.size();
+				m_ahead.resize(size);
+				size_t got = std::fread(&m_ahead[have], 1, size - have, input_file_ptr);
+				m_ahead.resize(have + got);
+				if (got < size - have)
+					return false;
+			}
+			if (size > 0)
+				std::memcpy(reinterpret_cast<void*>(p), &m_ahead[m_ahead_pos], size);
+			return true;
+		}
+		void fail() const
+		{
+			throw std::runtime_error("Read Error!");
+		}
+
+	private:
+		file_source(const file_source&);
+		file_source& operator=(const file_source&);
+
+		void compute_length()
+		{
+			file_size = input_file_ptr ? file_size64(input_file_ptr) : 0;
+			read_length = 0;
+		}
+		size_t ahead() const
+		{
+			return m_ahead.size() - m_ahead_pos;
+		}
+		void drop_ahead(size_t size)
+		{
+			m_ahead_pos += size;
+			if (m_ahead_pos == m_ahead.size())
+			{
+				m_ahead.clear();
+				m_ahead_pos = 0;
+			}
+		}
+
+		std::FILE* input_file_ptr;
+		int64_t file_size;
+		int64_t read_length;
+		unsigned m_hints;
+		std::vector<char> m_ahead; // read by look() but not yet by the stream
+		size_t m_ahead_pos;
+	};
+} // ns detail
+
+template<typename same_endian_type>
+using file_istream = basic_bin_istream<detail::file_source, same_endian_type>;
+
+// The Allocator provides the copy of the data, e.g. from a pool or an arena.
+template<typename same_endian_type, typename Allocator = std::allocator<char> >
+using mem_istream = basic_bin_istream<detail::vector_source<Allocator>, same_endian_type>;
+
+template<typename same_endian_type>
+using ptr_istream = basic_bin_istream<detail::pointer_source, same_endian_type>;
+
+template<typename same_endian_type>
+using memfile_istream = basic_bin_istream<detail::file_buffer_source, same_endian_type>;
+
+// shared_istream reads a shared_buffer. A copy of the stream is a cursor of
+// its own over the same bytes, so threads decode one buffer, or slices of it
+// from buffer().slice(), without copying it and without locks.
+template<typename same_endian_type>
+using shared_istream = basic_bin_istream<detail::shared_source, same_endian_type>;
+
+// positional_istream is a cursor over a positional_file with the usual
+// operators. Give each thread its own; they share the open file.
+template<typename same_endian_type>
+using positional_istream = basic_bin_istream<detail::positional_source, same_endian_type>;
+
+// prefetch_istream scans a file while a background thread reads ahead into
+// count blocks of block_size bytes, so the decoding and the disk overlap.
+// It is opened with (file, block_size, count, hints).
+template<typename same_endian_type>
+using prefetch_istream = basic_bin_istream<detail::prefetch_source, same_endian_type>;
+
+// segmented_istream reads a sequence of buffers or files added with add() and
+// add_file() as if they were one, e.g. the blocks of a rope_ostream or the
+// parts of a split file. Values are read in place; only one which straddles
+// two segments is put together from its pieces.
+template<typename same_endian_type>
+using segmented_istream = basic_bin_istream<detail::segment_source, same_endian_type>;
+
+// chunk_istream decodes data that arrives in pieces, e.g. from a socket.
+// Bytes are appended with feed(). A read which needs more bytes than are
+// buffered does not throw; it sets need_more() and leaves the value alone.
+// Wrap each record in begin()/commit(). Decoding does not resume where a
+// read stopped: when the record could not be completed, commit() returns
+// false and rewinds to its start, and the caller decodes the whole record
+// again from the start after a later feed(). The values read before the
+// short read are thrown away. To keep that from repeating on every small
+// feed(), begin() sets need_more() straight away until the bytes the failed
+// read wanted have arrived. Consumed bytes are dropped on feed() once they
+// are at least half of the buffer, so each byte is moved at most once on
+// average.
+template<typename same_endian_type>
+class chunk_istream
+{
+public:
+	typedef istream_tag stream_category;
+	typedef same_endian_type endian_type;
+
+	chunk_istream() : m_index(0), m_mark(0), m_wait(0), m_need_more(false), m_in_record(false) {}
+	chunk_istream(const char * mem, size_t size) : m_index(0), m_mark(0), m_wait(0), m_need_more(false), m_in_record(false)
+	{
+		feed(mem, size);
+	}
+	void feed(const char * mem, size_t size)
+	{
+		// drop the consumed bytes once they outweigh the unfinished ones
+		size_t consumed = m_in_record ? m_mark : m_index;
+		if (consumed > 0 && consumed * 2 >= m_vec.size())
+		{
+			m_vec.erase(m_vec.begin(), m_vec.begin() + consumed);
+
+			m_index -= consumed;
+			m_mark = m_mark > consumed ? m_mark - consumed : 0;
+			m_wait = m_wait > consumed ? m_wait - consumed : 0;
+		}
+		if (!m_in_record)
+			m_need_more = false;
+		m_vec.insert(m_vec.end(), mem, mem + size);
+	}
+	void close()
+	{
+		m_vec.clear();
+		m_index = 0; m_mark = 0; m_wait = 0; m_need_more = false; m_in_record = false;
+	}
+	bool eof() const
+	{
+		return m_index >= m_vec.size();
+	}
+	bool need_more() const
+	{
+		return m_need_more;
+	}
+	size_t available() const
+	{
+		return m_vec.size() - m_index;
+	}
+	uint64_t remaining() const
+	{
+		return available();
+	}
+	// sets need_more() when fewer than size bytes are buffered, so that a
+	// string or container is not sized from a length that has not arrived
+	void require(uint64_t size)
+	{
+		if (!m_need_more && size > available())
+		{
+			m_wait = (size_t)std::min<uint64_t>(m_index + size, SIZE_MAX);
+			m_need_more = true;
+		}
+	}
+	void begin()
+	{
+		m_mark = m_index;
+		m_need_more = m_vec.size() < m_wait;
+		m_in_record = true;
+	}
+	bool commit()
+	{
+		m_in_record = false;
+		if (m_need_more)
+		{
+			m_index = m_mark;
+			m_need_more = false;
+			return false;
+		}
+		m_mark = m_index;
+		m_wait = 0;
+		return true;
+	}
+
+	template<typename T>
+	void read(T& t)
+	{
+		if (!reserve(sizeof(T)))
+			return;
+
+		std::memcpy(reinterpret_cast<void*>(&t), &m_vec[m_index], sizeof(T));
+
+		simple::swap_endian_if_same_endian_is_false(t, m_same_type);
+
+		m_index += sizeof(T);
+	}
+
+	void read(typename std::vector<char>& vec)
+	{
+		read(vec.data(), vec.size());
+	}
+
+	void read(char* p, size_t size)
+	{
+		if (!reserve(size))
+			return;
+
+		std::memcpy(reinterpret_cast<void*>(p), &m_vec[m_index], size);
+
+		m_index += size;
+	}
+
+	void skip(size_t size)
+	{
+		if (!reserve(size))
+			return;
+
+		m_index += size;
+	}
+
+	template<typename T>
+	void skip()
+	{
+		static_assert(is_bitwise_serializable<T>::value, "use skip_string() for strings");
+		skip(sizeof(T));
+	}
+
+	// steps over a string by its length prefix, without allocating it
+	void skip_string()
+	{
+		int size = 0;
+		read(size);
+		if (size > 0)
+			skip((size_t)size);
+	}
+
+	// returns the next value without moving past it
+	template<typename T>
+	T peek()
+	{
+		T t = T();
+		if (!reserve(sizeof(T)))
+			return t;
+
+		std::memcpy(reinterpret_cast<void*>(&t), &m_vec[m_index], sizeof(T));
+		simple::swap_endian_if_same_endian_is_false(t, m_same_type);
+		return t;
+	}
+
+	void read(std::string& str, const unsigned int size)
+	{
+		str.clear();
+		detail::read_string(*this, str, size);
+	}
+
+private:
+	bool reserve(size_t size)
+	{
+		if (m_need_more)
+			return false;
+
+		if ((m_index + size) > m_vec.size())
+		{
+			m_wait = m_index + size;
+			m_need_more = true;
+			return false;
+		}
+		return true;
+	}
+
+	std::vector<char> m_vec;
+	size_t m_index;
+	size_t m_mark;
+	size_t m_wait; // buffered bytes the rewound record needs before it is retried
+	bool m_need_more;
+	bool m_in_record;
+	same_endian_type m_same_type;
+};
+
+namespace detail
+{
+	inline std::future<bool> ready_future(bool result)
+	{
+		std::promise<bool> promise;
+		promise.set_value(result);
+		return promise.get_future();
+	}
+
+	// Writes buffers to files on a background thread. push() hands over a
+	// full buffer and gives back an empty one from an earlier write, so the
+	// caller keeps serializing into warm memory. It blocks while max_pending
+	// buffers are waiting, which bounds the memory held by a slow disk.
+	// Buffers are moved, never copied, so they keep their allocator.
+	template<typename Buffer>
+	class basic_async_file_writer
+	{
+	public:
+		basic_async_file_writer(size_t max_pending) : m_max_pending(max_pending ? max_pending : 1), m_busy(false), m_stop(false), m_failed(false)
+		{
+			m_thread = std::thread(&basic_async_file_writer::run, this);
+		}
+		~basic_async_file_writer()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stop = true;
+			}
+			m_job_cond.notify_one();
+			m_thread.join();
+		}
+		void push(std::FILE* fp, Buffer& buf)
+		{
+			enqueue(fp, buf, job_write);
+		}
+		// completes when everything queued before it has reached the file
+		std::future<bool> flush(std::FILE* fp, Buffer& buf)
+		{
+			return enqueue(fp, buf, job_flush);
+		}
+		// like flush, and the file is closed on the background thread
+		std::future<bool> close(std::FILE* fp, Buffer& buf)
+		{
+			return enqueue(fp, buf, job_close);
+		}
+
+	private:
+		enum job_kind { job_write, job_flush, job_close };
+		struct job
+		{
+			job(std::FILE* fp_, Buffer&& data_, job_kind kind_) : fp(fp_), data(std::move(data_)), kind(kind_) {}
+			std::FILE* fp;
+			Buffer data;
+			job_kind kind;
+			std::shared_ptr<std::promise<bool> > done;
+		};
+
+		std::future<bool> enqueue(std::FILE* fp, Buffer& buf, job_kind kind)
+		{
+			std::shared_ptr<std::promise<bool> > done;
+			std::future<bool> result;
+			if (kind != job_write)
+			{
+				done = std::make_shared<std::promise<bool> >();
+				result = done->get_future();
+			}
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_space_cond.wait(lock, [this] { return m_jobs.size() + (m_busy ? 1 : 0) < m_max_pending; });
+			m_jobs.push_back(job(fp, std::move(buf), kind));
+			m_jobs.back().done = done;
+			buf.clear();
+			if (!m_free.empty())
+			{
+				buf = std::move(m_free.back());
+				m_free.pop_back();
+			}
+			lock.unlock();
+			m_job_cond.notify_one();
+			return result;
+		}
+		void run()
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			while (true)
+			{
+				m_job_cond.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+				if (m_jobs.empty())
+					return;
+				job j = std::move(m_jobs.front());
+				m_jobs.pop_front();
+				m_busy = true;
+				lock.unlock();
+
+				bool ok = true;
+				if (!j.data.empty())
+					ok = std::fwrite(j.data.data(), j.data.size(), 1, j.fp) == 1u;
+				if (j.kind == job_flush)
+					ok = (std::fflush(j.fp) == 0) && ok;
+				else if (j.kind == job_close)
+					ok = (std::fclose(j.fp) == 0) && ok;
+
+				lock.lock();
+				m_busy = false;
+				m_failed = m_failed || !ok;
+				if (j.done)
+				{
+					j.done->set_value(!m_failed);
+					m_failed = false;
+				}
+				j.data.clear();
+				if (m_free.size() < m_max_pending)
+					m_free.push_back(std::move(j.data));
+				m_space_cond.notify_all();
+			}
+		}
+
+		size_t m_max_pending;
+		std::deque<job> m_jobs;
+		std::vector<Buffer> m_free;
+		bool m_busy;
+		bool m_stop;
+		bool m_failed;
+		std::mutex m_mutex;
+		std::condition_variable m_job_cond;
+		std::condition_variable m_space_cond;
+		std::thread m_thread;
+	};
+
+	typedef basic_async_file_writer<std::vector<char> > async_file_writer;
+} // ns detail
+
+// The outcome of file_ostream::flush() and close(). A synchronous write is
+// known at once and needs no shared state; with enable_async_flush() it is
+// the future of the background write. It converts to std::future<bool>.
+class write_result
+{
+public:
+	write_result(bool ok) : m_ok(ok) {}
+	write_result(std::future<bool>&& result) : m_ok(false), m_result(std::move(result)) {}
+	// waits for the write; true when it succeeded
+	bool get()
+	{
+		return m_result.valid() ? m_result.get() : m_ok;
+	}
+	void wait() const
+	{
+		if (m_result.valid())
+			m_result.wait();
+	}
+	operator std::future<bool>()
+	{
+		return m_result.valid() ? std::move(m_result) : detail::ready_future(m_ok);
+	}
+
+private:
+	bool m_ok;
+	std::future<bool> m_result;
+};
+
+// A sink provides put(p, size); one which keeps its output in memory also
+// provides put_at(pos, p, size) for writeat().
+template<typename Sink, typename same_endian_type>
+class basic_bin_ostream : public Sink
+{
+public:
+	typedef ostream_tag stream_category;
+	typedef same_endian_type endian_type;
+
+	basic_bin_ostream() {}
+	// the arguments are passed on to the sink; a stream of the same type
+	// is copied by the copy constructor instead
+	template<typename Arg, typename... Args, typename = typename std::enable_if<!std::is_base_of<basic_bin_ostream, typename std::decay<Arg>::type>::value>::type>
+	basic_bin_ostream(Arg&& arg, Args&&... args) : Sink(std::forward<Arg>(arg), std::forward<Args>(args)...) {}
+
+	template<typename T>
+	void write(const T& t)
+	{
+		T t2 = t;
+		simple::swap_endian_if_same_endian_is_false(t2, m_same_type);
+		this->put(reinterpret_cast<const char*>(&t2), sizeof(T));
+	}
+	void write(const std::vector<char>& vec)
+	{
+		this->put(vec.data(), vec.size());
+	}
+	void write(const char* p, size_t size)
+	{
+		this->put(p, size);
+	}
+	template<typename T>
+	void writeat(size_t pos, const T& t)
+	{
+		T t2 = t;
+		simple::swap_endian_if_same_endian_is_false(t2, m_same_type);
+		this->put_at(pos, reinterpret_cast<const char*>(&t2), sizeof(T));
+	}
+	void writeat(size_t pos, const std::vector<char>& vec)
+	{
+		if (!vec.empty())
+			this->put_at(pos, vec.data(), vec.size());
+	}
+
+private:
+	same_endian_type m_same_type;
+};
+
+namespace detail
+{
+	// writes through stdio, optionally handing full buffers to a background thread
+	class file_sink
+	{
+	public:
+		file_sink() : output_file_ptr(nullptr), m_buffer_size(0), m_hints(hint_none), m_written(0), m_synced(0), m_dropped(0) {}
+		// hints is a combination of file_hint values
+		file_sink(const char * file, unsigned hints = hint_none) : output_file_ptr(nullptr), m_buffer_size(0), m_hints(hint_none), m_written(0), m_synced(0), m_dropped(0)
+		{
+			open(file, hints);
+		}
+#ifdef _MSC_VER
+		file_sink(const wchar_t * file, unsigned hints = hint_none) : output_file_ptr(nullptr), m_buffer_size(0), m_hints(hint_none), m_written(0), m_synced(0), m_dropped(0)
+		{
+			open(file, hints);
+		}
+#endif
+		~file_sink()
+		{
+			close();
+		}
+		void open(const char * file, unsigned hints = hint_none)
+		{
+			close();
+#ifdef _MSC_VER
+			output_file_ptr = nullptr;
+			fopen_s(&output_file_ptr, file, "wb");
+#else
+			output_file_ptr = std::fopen(file, "wb");
+#endif
+			start(hints);
+		}
+#ifdef _MSC_VER
+		void open(const wchar_t * file, unsigned hints = hint_none)
+		{
+			close();
+			output_file_ptr = nullptr;
+			_wfopen_s(&output_file_ptr, file, L"wb");
+			start(hints);
+		}
+#endif
+		// After this call, writes are collected in a buffer of buffer_size
+		// bytes and a background thread writes the full buffers, while the
+		// caller serializes into the next one. flush() and close() then return
+		// without waiting; call get() on the result to wait for the outcome.
+		void enable_async_flush(size_t buffer_size = 1 << 20, size_t max_pending = 2)
+		{
+			m_writer.reset(new async_file_writer(max_pending));
+			m_buffer_size = buffer_size;
+			m_buf.reserve(m_buffer_size);
+		}
+		write_result flush()
+		{
+			if (!output_file_ptr)
+				return false;
+			if (m_writer)
+				return m_writer->flush(output_file_ptr, m_buf);
+			return std::fflush(output_file_ptr) == 0;
+		}
+		write_result close()
+		{
+			if (!output_file_ptr)
+				return false;
+			std::FILE* fp = output_file_ptr;
+			output_file_ptr = nullptr;
+			if (m_writer)
+				return m_writer->close(fp, m_buf);
+			if (m_hints & hint_dontneed)
+				drop_all(fp);
+			return std::fclose(fp) == 0;
+		}
+		bool is_open()
+		{
+			return output_file_ptr != nullptr;
+		}
+
+	protected:
+		// writes nothing when the file failed to open
+		void put(const char* p, size_t size)
+		{
+			if (!output_file_ptr)
+				return;
+			if (m_writer)
+			{
+				m_buf.insert(m_buf.end(), p, p + size);
+				if (m_buf.size() >= m_buffer_size)
+					m_writer->push(output_file_ptr, m_buf);
+				return;
+			}
+			std::fwrite(reinterpret_cast<const void*>(p), size, 1, output_file_ptr);
+			if (m_hints & hint_writeback)
+			{
+				m_written += size;
+				if (m_written - m_synced >= (int64_t)writeback_chunk)
+					write_back();
+			}
+		}
+
+	private:
+		void start(unsigned hints)
+		{
+			m_hints = hints;
+			m_written = m_synced = m_dropped = 0;
+			advise_open(output_file_ptr, 0, m_hints & hint_noreuse);
+		}
+		// starts the writeback of the bytes since the last call and waits for
+		// the range before, which has had a chunk's time to complete
+		void write_back()
+		{
+#ifdef __linux__
+			std::fflush(output_file_ptr);
+			int fd = fileno(output_file_ptr);
+			sync_file_range(fd, m_synced, m_written - m_synced, SYNC_FILE_RANGE_WRITE);
+			if (m_synced > m_dropped)
+			{
+				sync_file_range(fd, m_dropped, m_synced - m_dropped,
+					SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+				if (m_hints & hint_dontneed)
+					advise_drop(output_file_ptr, m_dropped, m_synced - m_dropped);
+				m_dropped = m_synced;
+			}
+#endif
+			m_synced = m_written;
+		}
+		// dirty pages cannot be dropped, so the data is written out first
+		void drop_all(std::FILE* fp)
+		{
+#ifdef SIMPLE_BINSTREAM_FADVISE
+			std::fflush(fp);
+			fdatasync(fileno(fp));
+			advise_drop(fp, 0, 0);
+#else
+			(void)fp;
+#endif
+		}
+
+		file_sink(const file_sink&);
+		file_sink& operator=(const file_sink&);
+
+		std::FILE* output_file_ptr;
+		std::unique_ptr<async_file_writer> m_writer;
+		std::vector<char> m_buf;
+		size_t m_buffer_size;
+		unsigned m_hints;
+		int64_t m_written;
+		int64_t m_synced;
+		int64_t m_dropped;
+	};
+
+	// appends to a buffer from the Allocator
+	template<typename Allocator>
+	class vector_sink
+	{
+	public:
+		typedef Allocator allocator_type;
+		typedef std::vector<char, Allocator> buffer_type;
+
+		explicit vector_sink(const Allocator& alloc = Allocator()) : m_vec(alloc) {}
+		void close()
+		{
+			m_vec.clear();
+		}
+		// empties the stream and keeps the buffer for the next message
+		void clear()
+		{
+			m_vec.clear();
+		}
+		void reserve(size_t capacity)
+		{
+			m_vec.reserve(capacity);
+		}
+		size_t capacity() const
+		{
+			return m_vec.capacity();
+		}
+		// replaces a larger buffer with one of the given capacity
+		void trim(size_t capacity)
+		{
+			if (m_vec.capacity() <= capacity)
+				return;
+			buffer_type vec(m_vec.get_allocator());
+			vec.reserve(capacity);
+			vec.assign(m_vec.begin(), m_vec.end());
+			m_vec.swap(vec);
+		}
+		const buffer_type& get_internal_vec() const
+		{
+			return m_vec;
+		}
+		const char* data() const
+		{
+			return m_vec.data();
+		}
+		size_t size() const
+		{
+			return m_vec.size();
+		}
+		const_span span() const
+		{
+			return const_span(m_vec.data(), m_vec.size());
+		}
+
+	protected:
+		void put(const char* p, size_t size)
+		{
+			m_vec.insert(m_vec.end(), p, p + size);
+		}
+		void put_at(size_t pos, const char* p, size_t size)
+		{
+			std::memcpy(&m_vec[pos], reinterpret_cast<const void*>(p), size);
+		}
+
+		buffer_type m_vec;
+	};
+
+	// writes into memory which the caller provides and keeps alive
+	class pointer_sink
+	{
+	public:
+		pointer_sink() : m_arr(nullptr), m_capacity(0), m_size(0) {}
+		pointer_sink(char * mem, size_t capacity) : m_arr(mem), m_capacity(capacity), m_size(0) {}
+		void open(char * mem, size_t capacity)
+		{
+			m_arr = mem;
+			m_capacity = capacity;
+			m_size = 0;
+		}
+		void close()
+		{
+			m_size = 0;
+		}
+		// empties the stream and keeps the memory for the next message
+		void clear()
+		{
+			m_size = 0;
+		}
+		size_t capacity() const
+		{
+			return m_capacity;
+		}
+		const char* data() const
+		{
+			return m_arr;
+		}
+		size_t size() const
+		{
+			return m_size;
+		}
+		const_span span() const
+		{
+			return const_span(m_arr, m_size);
+		}
+
+	protected:
+		void put(const char* p, size_t size)
+		{
+			if (size > m_capacity - m_size)
+				throw std::runtime_error("Buffer overflow!");
+
+			std::memcpy(m_arr + m_size, reinterpret_cast<const void*>(p), size);
+			m_size += size;
+		}
+		void put_at(size_t pos, const char* p, size_t size)
+		{
+			if (pos > m_size || size > m_size - pos)
+				throw std::runtime_error("Buffer overflow!");
+
+			std::memcpy(m_arr + pos, reinterpret_cast<const void*>(p), size);
+		}
+
+	private:
+		char* m_arr;
+		size_t m_capacity;
+		size_t m_size;
+	};
+
+	// keeps up to InlineSize bytes in itself and only then allocates
+	template<size_t InlineSize, typename Allocator>
+	class small_buffer_sink
+	{
+	public:
+		typedef Allocator allocator_type;
+
+		explicit small_buffer_sink(const Allocator& alloc = Allocator()) : m_alloc(alloc), m_data(m_inline), m_size(0), m_capacity(InlineSize) {}
+		small_buffer_sink(const small_buffer_sink& other) : m_alloc(other.m_alloc), m_data(m_inline), m_size(0), m_capacity(InlineSize)
+		{
+			put(other.m_data, other.m_size);
+		}
+		small_buffer_sink(small_buffer_sink&& other) : m_alloc(other.m_alloc), m_data(m_inline), m_size(0), m_capacity(InlineSize)
+		{
+			take(other);
+		}
+		~small_buffer_sink()
+		{
+			release();
+		}
+		small_buffer_sink& operator=(const small_buffer_sink& other)
+		{
+			if (this != &other)
+			{
+				m_size = 0;
+				put(other.m_data, other.m_size);
+			}
+			return *this;
+		}
+		small_buffer_sink& operator=(small_buffer_sink&& other)
+		{
+			if (this != &other)
+			{
+				release();
+				m_alloc = other.m_alloc;
+				m_data = m_inline;
+				m_size = 0;
+				m_capacity = InlineSize;
+				take(other);
+			}
+			return *this;
+		}
+		void close()
+		{
+			m_size = 0;
+		}
+		// empties the stream and keeps the buffer for the next message
+		void clear()
+		{
+			m_size = 0;
+		}
+		void reserve(size_t capacity)
+		{
+			if (capacity > m_capacity)
+				grow(capacity);
+		}
+		size_t capacity() const
+		{
+			return m_capacity;
+		}
+		// true while the bytes fit in the inline storage
+		bool is_inline() const
+		{
+			return m_data == m_inline;
+		}
+		const char* data() const
+		{
+			return m_data;
+		}
+		size_t size() const
+		{
+			return m_size;
+		}
+		const_span span() const
+		{
+			return const_span(m_data, m_size);
+		}
+
+	protected:
+		void put(const char* p, size_t size)
+		{
+			if (size > m_capacity - m_size)
+				grow(std::max(m_capacity * 2, m_size + size));
+
+			std::memcpy(m_data + m_size, reinterpret_cast<const void*>(p), size);
+			m_size += size;
+		}
+		void put_at(size_t pos, const char* p, size_t size)
+		{
+			std::memcpy(m_data + pos, reinterpret_cast<const void*>(p), size);
+		}
+
+	private:
+		typedef std::allocator_traits<Allocator> traits;
+
+		void grow(size_t capacity)
+		{
+			char* p = traits::allocate(m_alloc, capacity);
+			if (m_size > 0)
+				std::memcpy(p, m_data, m_size);
+			release();
+			m_data = p;
+			m_capacity = capacity;
+		}
+		void release()
+		{
+			if (m_data != m_inline)
+				traits::deallocate(m_alloc, m_data, m_capacity);
+		}
+		// steals a heap buffer, copies inline bytes
+		void take(small_buffer_sink& other)
+		{
+			if (other.is_inline())
+			{
+				put(other.m_data, other.m_size);
+				return;
+			}
+			m_data = other.m_data;
+			m_size = other.m_size;
+			m_capacity = other.m_capacity;
+			other.m_data = other.m_inline;
+			other.m_size = 0;
+			other.m_capacity = InlineSize;
+		}
+
+		Allocator m_alloc;
+		char* m_data;
+		size_t m_size;
+		size_t m_capacity;
+		char m_inline[InlineSize];
+	};
+
+	// appends to a chain of equally sized blocks, which are never moved or copied
+	template<typename Allocator>
+	class block_chain_sink
+	{
+	public:
+		typedef Allocator allocator_type;
+
+		explicit block_chain_sink(size_t block_size = 1 << 16, const Allocator& alloc = Allocator())
+			: m_alloc(alloc), m_block_size(block_size), m_filled(0), m_size(0), m_cur(nullptr), m_end(nullptr) {}
+		~block_chain_sink()
+		{
+			close();
+		}
+		// frees the blocks
+		void close()
+		{
+			for (size_t i = 0; i < m_blocks.size(); ++i)
+				traits::deallocate(m_alloc, m_blocks[i], m_block_size);
+			m_blocks.clear();
+			clear();
+		}
+		// empties the stream and keeps the blocks for the next output
+		void clear()
+		{
+			m_filled = 0;
+			m_size = 0;
+			m_cur = m_end = nullptr;
+		}
+		size_t size() const
+		{
+			return m_size;
+		}
+		size_t block_size() const
+		{
+			return m_block_size;
+		}
+		// the number of blocks which hold data
+		size_t block_count() const
+		{
+			return m_filled;
+		}
+		// the data of block i, all of it except for the last block
+		const_span block(size_t i) const
+		{
+			return const_span(m_blocks[i], (i + 1 < m_filled) ? m_block_size : m_size - i * m_block_size);
+		}
+		bool write_to_file(const char* file) const
+		{
+#ifdef SIMPLE_BINSTREAM_POSIX
+			int fd = ::open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if (fd < 0)
+				return false;
+			bool ok = write_to_fd(fd);
+			return (::close(fd) == 0) && ok;
+#else
+#ifdef _MSC_VER
+			std::FILE* fp = nullptr;
+			fopen_s(&fp, file, "wb");
+#else
+			std::FILE* fp = std::fopen(file, "wb");
+#endif
+			return write_to_file(fp);
+#endif
+		}
+#ifdef _MSC_VER
+		bool write_to_file(const wchar_t* file) const
+		{
+			std::FILE* fp = nullptr;
+			_wfopen_s(&fp, file, L"wb");
+			return write_to_file(fp);
+		}
+#endif
+#ifdef SIMPLE_BINSTREAM_POSIX
+		// one iovec per block, for the caller's own writev or sendmsg
+		void iovecs(std::vector<struct iovec>& iov) const
+		{
+			iov.resize(m_filled);
+			for (size_t i = 0; i < m_filled; ++i)
+			{
+				const_span b = block(i);
+				iov[i].iov_base = const_cast<char*>(b.data());
+				iov[i].iov_len = b.size();
+			}
+		}
+		// writes all blocks with as few writev calls as IOV_MAX allows
+		bool write_to_fd(int fd) const
+		{
+#ifdef IOV_MAX
+			const size_t max_iov = IOV_MAX;
+#else
+			const size_t max_iov = 1024;
+#endif
+			std::vector<struct iovec> iov;
+			iovecs(iov);
+			size_t i = 0;
+			while (i < iov.size())
+			{
+				ssize_t written = ::writev(fd, &iov[i], (int)std::min(iov.size() - i, max_iov));
+				if (written < 0 && errno == EINTR)
+					continue;
+				if (written <= 0)
+					return false;
+
+				// steps over what was written, which may end inside a block
+				size_t done = (size_t)written;
+				while (i < iov.size() && done >= iov[i].iov_len)
+				{
+					done -= iov[i].iov_len;
+					++i;
+				}
+				if (done > 0)
+				{
+					iov[i].iov_base = static_cast<char*>(iov[i].iov_base) + done;
+					iov[i].iov_len -= done;
+				}
+			}
+			return true;
+		}
+#endif
+
+	protected:
+		void put(const char* p, size_t size)
+		{
+			if (size <= (size_t)(m_end - m_cur))
+			{
+				std::memcpy(m_cur, reinterpret_cast<const void*>(p), size);
+				m_cur += size;
+				m_size += size;
+				return;
+			}
+			for (;;)
+			{
+				size_t n = std::min((size_t)(m_end - m_cur), size);
+				if (n > 0)
+				{
+					std::memcpy(m_cur, reinterpret_cast<const void*>(p), n);
+					m_cur += n;
+					m_size += n;
+					p += n;
+					size -= n;
+				}
+				if (size == 0)
+					return;
+				next_block();
+			}
+		}
+		void put_at(size_t pos, const char* p, size_t size)
+		{
+			while (size > 0)
+			{
+				size_t offset = pos % m_block_size;
+				size_t n = std::min(m_block_size - offset, size);
+				std::memcpy(m_blocks[pos / m_block_size] + offset, reinterpret_cast<const void*>(p), n);
+				pos += n;
+				p += n;
+				size -= n;
+			}
+		}
+
+	private:
+		typedef std::allocator_traits<Allocator> traits;
+
+		block_chain_sink(const block_chain_sink&);
+		block_chain_sink& operator=(const block_chain_sink&);
+
+		void next_block()
+		{
+			if (m_filled == m_blocks.size())
+				m_blocks.push_back(traits::allocate(m_alloc, m_block_size));
+			m_cur = m_blocks[m_filled++];
+			m_end = m_cur + m_block_size;
+		}
+		bool write_to_file(std::FILE* fp) const
+		{
+			if (!fp)
+				return false;
+			bool ok = true;
+			for (size_t i = 0; i < m_filled && ok; ++i)
+			{
+				const_span b = block(i);
+				ok = std::fwrite(b.data(), b.size(), 1, fp) == 1u;
+			}
+			return (std::fclose(fp) == 0) && ok;
+		}
+
+		Allocator m_alloc;
+		std::vector<char*> m_blocks;
+		size_t m_block_size;
+		size_t m_filled;
+		size_t m_size;
+		char* m_cur;
+		char* m_end;
+	};
+
+	// a vector_sink which is saved to a file in one go
+	template<typename Allocator>
+	class memfile_sink : public vector_sink<Allocator>
+	{
+	public:
+		typedef typename vector_sink<Allocator>::buffer_type buffer_type;
+
+		explicit memfile_sink(const Allocator& alloc = Allocator()) : vector_sink<Allocator>(alloc) {}
+		bool write_to_file(const char* file)
+		{
+#ifdef _MSC_VER
+			std::FILE* fp = nullptr;
+			fopen_s(&fp, file, "wb");
+#else
+			std::FILE* fp = std::fopen(file, "wb");
+#endif
+			return write_to_file(fp);
+		}
+#ifdef _MSC_VER
+		bool write_to_file(const wchar_t* file)
+		{
+			std::FILE* fp = nullptr;
+			_wfopen_s(&fp, file, L"wb");
+			return write_to_file(fp);
+		}
+#endif
+		// Hands the buffer to a background thread which writes it to file, and
+		// continues with the buffer of an earlier write, so serializing the next
+		// file can start at once. At most max_pending buffers wait to be written.
+		std::future<bool> write_to_file_async(const char* file, size_t max_pending = 2)
+		{
+#ifdef _MSC_VER
+			std::FILE* fp = nullptr;
+			fopen_s(&fp, file, "wb");
+#else
+			std::FILE* fp = std::fopen(file, "wb");
+#endif
+			return write_to_file_async(fp, max_pending);
+		}
+#ifdef _MSC_VER
+		std::future<bool> write_to_file_async(const wchar_t* file, size_t max_pending = 2)
+		{
+			std::FILE* fp = nullptr;
+			_wfopen_s(&fp, file, L"wb");
+			return write_to_file_async(fp, max_pending);
+		}
+#endif
+
+	private:
+		bool write_to_file(std::FILE* fp)
+		{
+			if (!fp)
+				return false;
+			size_t size = std::fwrite(this->m_vec.data(), this->m_vec.size(), 1, fp);
+			std::fflush(fp);
+			std::fclose(fp);
+			this->m_vec.clear();
+			return size == 1u;
+		}
+		std::future<bool> write_to_file_async(std::FILE* fp, size_t max_pending)
+		{
+			if (!fp)
+				return ready_future(false);
+			if (!m_writer)
+				m_writer.reset(new basic_async_file_writer<buffer_type>(max_pending));
+			return m_writer->close(fp, this->m_vec);
+		}
+
+		std::unique_ptr<basic_async_file_writer<buffer_type> > m_writer;
+	};
+
+	// only counts the bytes
+	class counting_sink
+	{
+	public:
+		counting_sink() : m_size(0) {}
+		void close()
+		{
+			m_size = 0;
+		}
+		void clear()
+		{
+			m_size = 0;
+		}
+		size_t size() const
+		{
+			return m_size;
+		}
+
+	protected:
+		void put(const char*, size_t size)
+		{
+			m_size += size;
+		}
+
+	private:
+		size_t m_size;
+	};
+} // ns detail
+
+template<typename same_endian_type>
+using file_ostream = basic_bin_ostream<detail::file_sink, same_endian_type>;
+
+// The Allocator provides the buffer, e.g. from a pool, an arena or huge pages.
+template<typename same_endian_type, typename Allocator = std::allocator<char> >
+using mem_ostream = basic_bin_ostream<detail::vector_sink<Allocator>, same_endian_type>;
+
+// small_mem_ostream keeps messages up to InlineSize bytes in the stream object
+// itself, so encoding a small message on the stack does not allocate. A larger
+// message moves to a buffer from the Allocator. span() gives the bytes.
+template<typename same_endian_type, size_t InlineSize = 128, typename Allocator = std::allocator<char> >
+using small_mem_ostream = basic_bin_ostream<detail::small_buffer_sink<InlineSize, Allocator>, same_endian_type>;
+
+// rope_ostream collects the output in a chain of blocks of block_size bytes
+// instead of one growing buffer, so written data is never copied again and a
+// large output does not need twice its size while it grows. writeat() works
+// across blocks. write_to_fd() hands the blocks to writev; iovecs() and
+// block() give them to the caller. Neither empties the stream.
+template<typename same_endian_type, typename Allocator = std::allocator<char> >
+using rope_ostream = basic_bin_ostream<detail::block_chain_sink<Allocator>, same_endian_type>;
+
+// ptr_ostream writes into a fixed-size buffer of the caller, e.g. a stack
+// array or a slot of a ring, and never allocates. A write which does not fit
+// throws without copying anything, but an operator of several writes, e.g.
+// for a string, may have written its first ones; write_all() writes a record
+// in one go. writeat() only overwrites bytes which were already written.
+template<typename same_endian_type>
+using ptr_ostream = basic_bin_ostream<detail::pointer_sink, same_endian_type>;
+
+// mem_ostream_pool hands out mem_ostreams with warm buffers and takes them
+// back when the returned pointer is destroyed, so encoding a message does not
+// regrow a buffer from zero. For each message type it keeps a histogram of
+// the sizes written and presizes the buffers to about the 95th percentile; a
+// buffer which an outlier grew beyond twice that size is trimmed when it comes
+// back. The pool is thread-safe and must outlive the streams it handed out.
+template<typename same_endian_type, typename Allocator = std::allocator<char> >
+class mem_ostream_pool
+{
+public:
+	typedef mem_ostream<same_endian_type, Allocator> stream_type;
+
+	class releaser
+	{
+	public:
+		releaser() : m_pool(nullptr), m_type(0) {}
+		releaser(mem_ostream_pool* pool, unsigned type) : m_pool(pool), m_type(type) {}
+		void operator()(stream_type* ostm) const
+		{
+			if (m_pool)
+				m_pool->release(ostm, m_type);
+			else
+				delete ostm;
+		}
+	private:
+		mem_ostream_pool* m_pool;
+		unsigned m_type;
+	};
+	typedef std::unique_ptr<stream_type, releaser> pointer;
+
+	explicit mem_ostream_pool(size_t max_free = 16, const Allocator& alloc = Allocator()) : m_max_free(max_free), m_alloc(alloc) {}
+	~mem_ostream_pool()
+	{
+		for (size_t i = 0; i < m_free.size(); ++i)
+			delete m_free[i];
+	}
+
+	pointer acquire(unsigned type = 0)
+	{
+		stream_type* ostm = nullptr;
+		size_t predicted = 0;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			predicted = m_stats[type].predicted;
+			if (!m_free.empty())
+			{
+				ostm = m_free.back();
+				m_free.pop_back();
+			}
+		}
+		if (!ostm)
+			ostm = new stream_type(m_alloc);
+		ostm->reserve(predicted);
+		return pointer(ostm, releaser(this, type));
+	}
+	size_t predicted_size(unsigned type) const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		typename std::unordered_map<unsigned, size_stats>::const_iterator it = m_stats.find(type);
+		return (it != m_stats.end()) ? it->second.predicted : 0;
+	}
+
+private:
+	mem_ostream_pool(const mem_ostream_pool&);
+	mem_ostream_pool& operator=(const mem_ostream_pool&);
+
+	// 8 exact buckets for the smallest sizes, then 4 buckets per power of 2
+	enum { bucket_count = 8 + (sizeof(size_t) * 8 - 3) * 4 };
+
+	struct size_stats
+	{
+		size_stats() : total(0), since_update(0), predicted(0)
+		{
+			std::fill(counts, counts + bucket_count, 0u);
+		}
+		unsigned counts[bucket_count];
+		unsigned total;
+		unsigned since_update;
+		size_t predicted;
+	};
+
+	static size_t bucket_of(size_t size)
+	{
+		if (size < 8)
+			return size;
+		size_t log = 3;
+		while ((size >> (log + 1)) != 0)
+			++log;
+		return 8 + (log - 3) * 4 + ((size >> (log - 2)) & 3);
+	}
+	// the largest size which falls in the bucket
+	static size_t bucket_limit(size_t bucket)
+	{
+		if (bucket < 8)
+			return bucket;
+		size_t log = (bucket - 8) / 4 + 3;
+		size_t sub = (bucket - 8) % 4;
+		return ((5 + sub) << (log - 2)) - 1;
+	}
+	static void record(size_stats& stats, size_t size)
+	{
+		++stats.counts[bucket_of(size)];
+		++stats.total;
+		// halve the old counts now and then, so the prediction follows the traffic
+		if (stats.total >= 4096)
+		{
+			stats.total = 0;
+			for (size_t i = 0; i < bucket_count; ++i)
+			{
+				stats.counts[i] /= 2;
+				stats.total += stats.counts[i];
+			}
+		}
+		// the percentile is recomputed for each of the first messages, then every 16th
+		if (stats.total > 16 && ++stats.since_update < 16)
+			return;
+		stats.since_update = 0;
+		unsigned wanted = stats.total - stats.total / 20;
+		unsigned seen = 0;
+		for (size_t i = 0; i < bucket_count; ++i)
+		{
+			seen += stats.counts[i];
+			if (seen >= wanted)
+			{
+				stats.predicted = bucket_limit(i);
+				break;
+			}
+		}
+	}
+
+	void release(stream_type* ostm, unsigned type)
+	{
+		size_t predicted = 0;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			size_stats& stats = m_stats[type];
+			record(stats, ostm->size());
+			predicted = stats.predicted;
+		}
+		ostm->clear();
+		if (ostm->capacity() > predicted * 2)
+			ostm->trim(predicted);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_free.size() < m_max_free)
+			{
+				m_free.push_back(ostm);
+				return;
+			}
+		}
+		delete ostm;
+	}
+
+	size_t m_max_free;
+	Allocator m_alloc;
+	std::vector<stream_type*> m_free;
+	std::unordered_map<unsigned, size_stats> m_stats;
+	mutable std::mutex m_mutex;
+};
+
+template<typename same_endian_type, typename Allocator = std::allocator<char> >
+using memfile_ostream = basic_bin_ostream<detail::memfile_sink<Allocator>, same_endian_type>;
+
+// size_ostream accepts everything the other output streams do but only
+// counts the bytes, to learn the encoded size without encoding, e.g. to
+// write a length prefix or to presize a buffer.
+template<typename same_endian_type = std::true_type>
+using size_ostream = basic_bin_ostream<detail::counting_sink, same_endian_type>;
+
+namespace detail
+{
+	// fixed_size<T>::value is the encoded size of the types whose encoding
+	// never varies, numbers and aggregates of them, and 0 for the others
+	template<typename T, typename = void>
+	struct fixed_size : std::integral_constant<size_t, 0> { };
+
+	template<typename T>
+	struct fixed_size<T, typename std::enable_if<std::is_arithmetic<T>::value || std::is_enum<T>::value>::type>
+		: std::integral_constant<size_t, sizeof(T)> { };
+
+	template<typename... Ts>
+	struct fixed_size_sum;
+
+	template<>
+	struct fixed_size_sum<> : std::integral_constant<size_t, 0> { };
+
+	// 0 as soon as one of the types has no fixed size
+	template<typename Head, typename... Rest>
+	struct fixed_size_sum<Head, Rest...>
+	{
+		static const size_t head = fixed_size<typename std::remove_cv<typename std::remove_reference<Head>::type>::type>::value;
+		static const size_t rest = fixed_size_sum<Rest...>::value;
+		static const size_t value = (head == 0 || (sizeof...(Rest) > 0 && rest == 0)) ? 0 : head + rest;
+	};
+
+	template<typename T, size_t N>
+	struct fixed_size<T[N], void> : std::integral_constant<size_t, fixed_size<T>::value * N> { };
+
+	template<typename T, size_t N>
+	struct fixed_size<std::array<T, N>, void> : std::integral_constant<size_t, fixed_size<T>::value * N> { };
+
+	template<typename T1, typename T2>
+	struct fixed_size<std::pair<T1, T2>, void> : fixed_size_sum<T1, T2> { };
+
+	template<typename... Ts>
+	struct fixed_size<std::tuple<Ts...>, void> : fixed_size_sum<Ts...> { };
+
+	template<typename Tuple>
+	struct fixed_fields_size;
+
+	template<typename... Ts>
+	struct fixed_fields_size<std::tuple<Ts...> > : fixed_size_sum<Ts...> { };
+
+	template<typename T>
+	struct fixed_size<T, typename std::enable_if<has_fields<T>::value>::type>
+		: fixed_fields_size<decltype(std::declval<T&>().simple_binstream_fields())> { };
+} // ns detail
+
+template<typename T>
+struct has_fixed_size : std::integral_constant<bool, (detail::fixed_size<T>::value > 0)> { };
+
+// The encoded size of a fixed-size type, known at compile time.
+template<typename T>
+constexpr typename std::enable_if<has_fixed_size<T>::value, size_t>::type serialized_size()
+{
+	return detail::fixed_size<T>::value;
+}
+
+// The encoded size of val; counted with a size_ostream unless the type has a fixed size.
+template<typename T>
+typename std::enable_if<has_fixed_size<T>::value, size_t>::type serialized_size(const T&)
+{
+	return detail::fixed_size<T>::value;
+}
+
+template<typename T>
+typename std::enable_if<!has_fixed_size<T>::value, size_t>::type serialized_size(const T& val)
+{
+	size_ostream<std::true_type> ostm;
+	ostm << val;
+	return ostm.size();
+}
+
+namespace detail
+{
+	// values which write_all packs itself: numbers, enums and strings
+	template<typename T>
+	struct is_packable : std::integral_constant<bool, std::is_arithmetic<T>::value || std::is_enum<T>::value
+		|| std::is_same<T, std::string>::value || std::is_convertible<const T&, const char*>::value> { };
+
+	template<typename... Ts>
+	struct all_packable;
+
+	template<>
+	struct all_packable<> : std::true_type { };
+
+	template<typename Head, typename... Rest>
+	struct all_packable<Head, Rest...> : std::integral_constant<bool, is_packable<Head>::value && all_packable<Rest...>::value> { };
+
+	template<typename T>
+	typename std::enable_if<std::is_arithmetic<T>::value || std::is_enum<T>::value, size_t>::type packed_size(const T&)
+	{
+		return sizeof(T);
+	}
+	inline size_t packed_size(const std::string& str)
+	{
+		return sizeof(int) + str.size();
+	}
+	inline size_t packed_size(const char* str)
+	{
+		return sizeof(int) + std::strlen(str);
+	}
+
+	template<typename same_endian_type, typename T>
+	typename std::enable_if<std::is_arithmetic<T>::value || std::is_enum<T>::value>::type pack(char*& p, const T& val)
+	{
+		T t = val;
+		simple::swap_endian_if_same_endian_is_false(t, same_endian_type());
+		std::memcpy(p, &t, sizeof(T));
+		p += sizeof(T);
+	}
+	template<typename same_endian_type>
+	void pack_chars(char*& p, const char* str, size_t size)
+	{
+		pack<same_endian_type>(p, (int)size);
+		std::memcpy(p, str, size);
+		p += size;
+	}
+	template<typename same_endian_type>
+	void pack(char*& p, const std::string& str)
+	{
+		pack_chars<same_endian_type>(p, str.data(), str.size());
+	}
+	template<typename same_endian_type>
+	void pack(char*& p, const char* str)
+	{
+		pack_chars<same_endian_type>(p, str, std::strlen(str));
+	}
+
+	// larger records gain nothing from the extra copy
+	const size_t write_all_buffer_size = 256;
+
+	template<typename Stream, typename... Ts>
+	void write_each(Stream& ostm, const Ts&... vals)
+	{
+		int expand[] = { 0, ((void)(ostm << vals), 0)... };
+		(void)expand;
+	}
+
+	template<typename Stream, typename... Ts>
+	void write_all(Stream& ostm, std::false_type, const Ts&... vals)
+	{
+		write_each(ostm, vals...);
+	}
+
+	template<typename Stream, typename... Ts>
+	void write_all(Stream& ostm, std::true_type, const Ts&... vals)
+	{
+		size_t sizes[] = { 0, packed_size(vals)... };
+		size_t total = 0;
+		for (size_t i = 1; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+			total += sizes[i];
+		if (total > write_all_buffer_size)
+		{
+			write_each(ostm, vals...);
+			return;
+		}
+
+		char buf[write_all_buffer_size];
+		char* p = buf;
+		int expand[] = { 0, (pack<typename Stream::endian_type>(p, vals), 0)... };
+		(void)expand;
+		ostm.write(buf, total);
+	}
+} // ns detail
+
+// Writes the values in order, like ostm << a << b << c. When they are all
+// numbers and strings, they are packed into one small buffer and handed to
+// the stream in a single write: one capacity check or one fwrite per record
+// instead of one per value.
+template<typename Stream, typename... Ts>
+typename std::enable_if<is_ostream<Stream>::value>::type write_all(Stream& ostm, const Ts&... vals)
+{
+	detail::write_all(ostm, detail::all_packable<Ts...>(), vals...);
+}
+
+
+#ifdef SIMPLE_BINSTREAM_IO_URING
+namespace detail
+{
+	// Minimal io_uring wrapper on the raw system calls, so that liburing is
+	// not needed. The submission array is filled with an identity mapping
+	// once, after which an entry is queued by just advancing the tail.
+	class io_uring_queue
+	{
+	public:
+		io_uring_queue() : m_fd(-1), m_sq_ptr(nullptr), m_cq_ptr(nullptr), m_sqes(nullptr),
+			m_sq_len(0), m_cq_len(0), m_sqes_len(0), m_sqe_tail(0) {}
+		~io_uring_queue()
+		{
+			close();
+		}
+		bool open(unsigned entries)
+		{
+			close();
+			io_uring_params params;
+			std::memset(&params, 0, sizeof(params));
+			m_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+			if (m_fd < 0)
+				return false;
+
+			m_sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+			m_cq_len = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+			if (single_mmap)
+			{
+				if (m_cq_len > m_sq_len)
+					m_sq_len = m_cq_len;
+				m_cq_len = 0;
+			}
+			m_sq_ptr = mmap(nullptr, m_sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+			if (m_sq_ptr == MAP_FAILED)
+			{
+				m_sq_ptr = nullptr;
+				close();
+				return false;
+			}
+			if (single_mmap)
+				m_cq_ptr = m_sq_ptr;
+			else
+			{
+				m_cq_ptr = mmap(nullptr, m_cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+				if (m_cq_ptr == MAP_FAILED)
+				{
+					m_cq_ptr = nullptr;
+					close();
+					return false;
+				}
+			}
+			m_sqes_len = params.sq_entries * sizeof(io_uring_sqe);
+			void* sqes = mmap(nullptr, m_sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+			if (sqes == MAP_FAILED)
+			{
+				close();
+				return false;
+			}
+			m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+			char* sq = static_cast<char*>(m_sq_ptr);
+			m_sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+			m_sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+			m_sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+			m_sq_entries = params.sq_entries;
+			unsigned* sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+			for (unsigned i = 0; i < m_sq_entries; ++i)
+				sq_array[i] = i;
+
+			char* cq = static_cast<char*>(m_cq_ptr);
+			m_cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+			m_cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+			m_cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+			m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+			m_sqe_tail = *m_sq_tail;
+			return true;
+		}
+		void close()
+		{
+			if (m_sqes)
+				munmap(m_sqes, m_sqes_len);
+			if (m_cq_ptr && m_cq_ptr != m_sq_ptr)
+				munmap(m_cq_ptr, m_cq_len);
+			if (m_sq_ptr)
+				munmap(m_sq_ptr, m_sq_len);
+			if (m_fd >= 0)
+				::close(m_fd);
+			m_fd = -1; m_sq_ptr = nullptr; m_cq_ptr = nullptr; m_sqes = nullptr;
+		}
+		bool is_open() const
+		{
+			return m_fd >= 0;
+		}
+		// returns a zeroed entry or nullptr when the submission queue is full
+		io_uring_sqe* get_sqe()
+		{
+			unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+			if (m_sqe_tail - head >= m_sq_entries)
+				return nullptr;
+			io_uring_sqe* sqe = &m_sqes[m_sqe_tail & m_sq_mask];
+			++m_sqe_tail;
+			std::memset(sqe, 0, sizeof(*sqe));
+			return sqe;
+		}
+		// Submits the queued entries and optionally waits for completions.
+		// Returns the number taken by the kernel or -errno; the entries it
+		// did not take stay queued and are submitted again by the next call.
+		int submit(unsigned wait_nr = 0)
+		{
+			__atomic_store_n(m_sq_tail, m_sqe_tail, __ATOMIC_RELEASE);
+			unsigned to_submit = pending();
+			if (to_submit == 0 && wait_nr == 0)
+				return 0;
+			return enter(to_submit, wait_nr);
+		}
+		// the entries queued which the kernel has not taken yet
+		unsigned pending() const
+		{
+			return m_sqe_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+		}
+		// Takes back the entries the kernel has not taken, e.g. after submit()
+		// failed, and passes the user_data of each to f. Only valid while no
+		// other thread submits.
+		template<typename F>
+		void withdraw(F f)
+		{
+			unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+			for (unsigned i = head; i != m_sqe_tail; ++i)
+				f(m_sqes[i & m_sq_mask].user_data);
+			m_sqe_tail = head;
+			__atomic_store_n(m_sq_tail, head, __ATOMIC_RELEASE);
+		}
+		int wait(unsigned wait_nr)
+		{
+			return enter(0, wait_nr);
+		}
+		bool peek_cqe(io_uring_cqe& cqe)
+		{
+			unsigned head = *m_cq_head;
+			if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE))
+				return false;
+			cqe = m_cqes[head & m_cq_mask];
+			__atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+			return true;
+		}
+		unsigned entries() const
+		{
+			return m_sq_entries;
+		}
+		bool register_files(const int* fds, unsigned count)
+		{
+			return syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_FILES, fds, count) == 0;
+		}
+		bool register_buffers(const iovec* iov, unsigned count)
+		{
+			return syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS, iov, count) == 0;
+		}
+
+	private:
+		int enter(unsigned to_submit, unsigned wait_nr)
+		{
+			while (true)
+			{
+				int ret = (int)syscall(__NR_io_uring_enter, m_fd, to_submit, wait_nr,
+					wait_nr ? IORING_ENTER_GETEVENTS : 0u, nullptr, 0);
+				if (ret >= 0 || errno != EINTR)
+					return ret < 0 ? -errno : ret;
+			}
+		}
+
+		int m_fd;
+		void* m_sq_ptr;
+		void* m_cq_ptr;
+		io_uring_sqe* m_sqes;
+		size_t m_sq_len;
+		size_t m_cq_len;
+		size_t m_sqes_len;
+		unsigned* m_sq_head;
+		unsigned* m_sq_tail;
+		unsigned m_sq_mask;
+		unsigned m_sq_entries;
+		unsigned* m_cq_head;
+		unsigned* m_cq_tail;
+		unsigned m_cq_mask;
+		io_uring_cqe* m_cqes;
+		unsigned m_sqe_tail;
+	};
+} // ns detail
+#endif // SIMPLE_BINSTREAM_IO_URING
+
+#ifdef SIMPLE_BINSTREAM_POSIX
+namespace detail
+{
+	// the alignment of O_DIRECT transfers: buffers, offsets and sizes
+	const size_t direct_alignment = 4096;
+
+	inline size_t align_up(size_t size)
+	{
+		return (size + direct_alignment - 1) / direct_alignment * direct_alignment;
+	}
+	// Opens with O_DIRECT where available and tries one aligned transfer,
+	// because some file systems only refuse O_DIRECT on the first read or
+	// write. Returns the fd, with O_DIRECT cleared when refused.
+	inline int open_direct(const char * file, int flags, bool& direct)
+	{
+		direct = false;
+#ifdef O_DIRECT
+		int fd = ::open(file, flags | O_DIRECT, 0644);
+		if (fd < 0)
+			return ::open(file, flags, 0644);
+		void* p = nullptr;
+		if (posix_memalign(&p, direct_alignment, direct_alignment) != 0)
+		{
+			::close(fd);
+			return ::open(file, flags, 0644);
+		}
+		char* buf = static_cast<char*>(p);
+		ssize_t ret = 0;
+		if ((flags & O_ACCMODE) == O_RDONLY)
+			ret = ::pread(fd, buf, direct_alignment, 0);
+		else
+		{
+			std::memset(buf, 0, direct_alignment);
+			ret = ::pwrite(fd, buf, direct_alignment, 0);
+			if (ret >= 0 && ::ftruncate(fd, 0) != 0)
+				ret = -1;
+		}
+		std::free(buf);
+		if (ret < 0)
+		{
+			::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_DIRECT);
+			return fd;
+		}
+		direct = true;
+		return fd;
+#else
+		return ::open(file, flags, 0644);
+#endif
+	}
+
+	// A fixed set of equally sized blocks, each of which is read or written
+	// at a file offset in the background. With io_uring the blocks and the
+	// file are registered once, so the kernel does not map them on every
+	// request; without it, the transfer is done with pread/pwrite on start().
+	class block_io_engine
+	{
+	public:
+		struct block
+		{
+			char* data;
+			uint64_t offset;
+			size_t size;
+			size_t done;
+			bool write;
+			bool busy;
+		};
+
+		block_io_engine() : m_fd(-1), m_block_size(0), m_error(0), m_fixed_buffers(false), m_fixed_file(false), m_ring_failed(false) {}
+		~block_io_engine()
+		{
+			close();
+		}
+		bool open(int fd, size_t block_size, unsigned count)
+		{
+			close();
+			m_fd = fd;
+			m_block_size = block_size;
+			m_blocks.resize(count);
+			for (unsigned i = 0; i < count; ++i)
+			{
+				void* p = nullptr;
+				if (posix_memalign(&p, 4096, block_size) != 0)
+				{
+					close();
+					return false;
+				}
+				block b = { static_cast<char*>(p), 0, 0, 0, false, false };
+				m_blocks[i] = b;
+			}
+#ifdef SIMPLE_BINSTREAM_IO_URING
+			if (m_ring.open(count * 2))
+			{
+				std::vector<iovec> iov(count);
+				for (unsigned i = 0; i < count; ++i)
+				{
+					iov[i].iov_base = m_blocks[i].data;
+					iov[i].iov_len = block_size;
+				}
+				// both fail when RLIMIT_MEMLOCK is too small; plain requests still work
+				m_fixed_buffers = m_ring.register_buffers(iov.data(), count);
+				m_fixed_file = m_ring.register_files(&m_fd, 1);
+			}
+#endif
+			return true;
+		}
+		void close()
+		{
+			if (!m_blocks.empty())
+				wait_all();
+#ifdef SIMPLE_BINSTREAM_IO_URING
+			m_ring.close();
+#endif
+			for (size_t i = 0; i < m_blocks.size(); ++i)
+				std::free(m_blocks[i].data);
+			m_blocks.clear();
+			m_fd = -1; m_error = 0; m_fixed_buffers = false; m_fixed_file = false; m_ring_failed = false;
+		}
+		bool uses_io_uring() const
+		{
+#ifdef SIMPLE_BINSTREAM_IO_URING
+			return m_ring.is_open();
+#else
+			return false;
+#endif
+		}
+		unsigned count() const
+		{
+			return (unsigned)m_blocks.size();
+		}
+		size_t block_size() const
+		{
+			return m_block_size;
+		}
+		block& operator[](unsigned i)
+		{
+			return m_blocks[i];
+		}
+		int error() const
+		{
+			return m_error;
+		}
+		// queues the transfer of block i; call submit() to hand a batch to the kernel
+		void start(unsigned i, uint64_t offset, size_t size, bool write)
+		{
+			block& b = m_blocks[i];
+			b.offset = offset; b.size = size; b.done = 0; b.write = write; b.busy = true;
+			if (size == 0)
+			{
+				b.busy = false;
+				return;
+			}
+#ifdef SIMPLE_BINSTREAM_IO_URING
+			if (m_ring.is_open() && !m_ring_failed)
+			{
+				queue(i);
+				return;
+			}
+#endif
+			transfer(i);
+		}
+		void submit()
+		{
+#ifdef SIMPLE_BINSTREAM_IO_URING
+			if (m_ring.is_open() && !m_ring_failed)
+				check(m_ring.submit());
+#endif
+		}
+		void wait(unsigned i)
+		{
+			while (m_blocks[i].busy)
+				reap();
+		}
+		void wait_all()
+		{
+			for (unsigned i = 0; i < m_blocks.size(); ++i)
+				wait(i);
+		}
+
+	private:
+		// transfers the rest of block i with pwrite or pread
+		void transfer(unsigned i)
+		{
+			block& b = m_blocks[i];
+			while (b.done < b.size)
+			{
+				ssize_t ret = b.write ? ::pwrite(m_fd, b.data + b.done, b.size - b.done, (off_t)(b.offset + b.done))
+					: ::pread(m_fd, b.data + b.done, b.size - b.done, (off_t)(b.offset + b.done));
+				if (ret < 0 && errno == EINTR)
+					continue;
+				if (ret == 0 && !b.write)
+				{
+					// the end of the file, a read of a rounded up size ends here
+					b.size = b.done;
+					break;
+				}
+				if (ret <= 0)
+				{
+					m_error = (ret < 0) ? errno : EIO;
+					break;
+				}
+				b.done += (size_t)ret;
+			}
+			b.busy = false;
+		}
+#ifdef SIMPLE_BINSTREAM_IO_URING
+		// Returns false when io_uring_enter failed with anything but a full
+		// or busy ring. The entries the kernel did not take are then done
+		// with pwrite/pread, and so is every later transfer.
+		bool check(int ret)
+		{
+			if (ret >= 0 || ret == -EAGAIN || ret == -EBUSY || ret == -EINTR)
+				return true;
+			m_ring_failed = true;
+			m_ring.withdraw([this](uint64_t user_data) { transfer((unsigned)(user_data - 1)); });
+			return false;
+		}
+		void queue(unsigned i)
+		{
+			block& b = m_blocks[i];
+			io_uring_sqe* sqe = m_ring.get_sqe();
+			while (sqe == nullptr)
+			{
+				if (check(m_ring.submit()))
+					reap();
+				if (m_ring_failed)
+				{
+					transfer(i);
+					return;
+				}
+				sqe = m_ring.get_sqe();
+			}
+			if (m_fixed_buffers)
+			{
+				sqe->opcode = b.write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+				sqe->buf_index = (uint16_t)i;
+			}
+			else
+				sqe->opcode = b.write ? IORING_OP_WRITE : IORING_OP_READ;
+			if (m_fixed_file)
+			{
+				sqe->fd = 0;
+				sqe->flags = IOSQE_FIXED_FILE;
+			}
+			else
+				sqe->fd = m_fd;
+			sqe->addr = reinterpret_cast<uint64_t>(b.data + b.done);
+			sqe->len = (unsigned)(b.size - b.done);
+			sqe->off = b.offset + b.done;
+			sqe->user_data = i + 1;
+		}
+#endif
+		void reap()
+		{
+#ifdef SIMPLE_BINSTREAM_IO_URING
+			// submits whatever is queued and waits for at least one completion
+			int ret = m_ring.submit(1);
+			if (!check(ret))
+			{
+				// the blocks the kernel took cannot be waited for any more
+				for (size_t i = 0; i < m_blocks.size(); ++i)
+				{
+					if (m_blocks[i].busy)
+					{
+						m_error = -ret;
+						m_blocks[i].busy = false;
+					}
+				}
+				return;
+			}
+			io_uring_cqe cqe;
+			bool requeued = false;
+			while (m_ring.peek_cqe(cqe))
+			{
+				block& b = m_blocks[(unsigned)(cqe.user_data - 1)];
+				if (cqe.res == 0 && !b.write)
+				{
+					b.size = b.done;
+					b.busy = false;
+					continue;
+				}
+				if (cqe.res <= 0)
+				{
+					m_error = (cqe.res < 0) ? -cqe.res : EIO;
+					b.busy = false;
+					continue;
+				}
+				b.done += (size_t)cqe.res;
+				if (b.done < b.size)
+				{
+					// short transfer, continue with the rest
+					queue((unsigned)(cqe.user_data - 1));
+					requeued = true;
+				}
+				else
+					b.busy = false;
+			}
+			if (requeued && !m_ring_failed)
+				check(m_ring.submit());
+#endif
+		}
+
+		int m_fd;
+		size_t m_block_size;
+		std::vector<block> m_blocks;
+		int m_error;
+		bool m_fixed_buffers;
+		bool m_fixed_file;
+		bool m_ring_failed; // io_uring_enter failed, the rest goes through pwrite/pread
+#ifdef SIMPLE_BINSTREAM_IO_URING
+		io_uring_queue m_ring;
+#endif
+	};
+	// writes through a block_io_engine, several blocks in flight
+	class uring_sink
+	{
+	public:
+		// hints is hint_none or hint_direct; queue_depth is at least 2, so that
+		// one block is filled while another is written
+		uring_sink(size_t block_size = 1 << 20, unsigned queue_depth = 4, unsigned hints = hint_none)
+			: m_fd(-1), m_block_size(block_size), m_queue_depth(queue_depth < 2 ? 2 : queue_depth), m_cur(0), m_offset(0), m_hints(hints), m_direct(false) {}
+		uring_sink(const char * file, size_t block_size = 1 << 20, unsigned queue_depth = 4, unsigned hints = hint_none)
+			: m_fd(-1), m_block_size(block_size), m_queue_depth(queue_depth < 2 ? 2 : queue_depth), m_cur(0), m_offset(0), m_hints(hints), m_direct(false)
+		{
+			open(file);
+		}
+		// call close() to know whether the last writes succeeded
+		~uring_sink()
+		{
+			close();
+		}
+		void open(const char * file)
+		{
+			open(file, m_hints);
+		}
+		void open(const char * file, unsigned hints)
+		{
+			close();
+			m_hints = hints;
+			if (hints & hint_direct)
+				m_fd = open_direct(file, O_WRONLY | O_CREAT | O_TRUNC, m_direct);
+			else
+				m_fd = ::open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			// with O_DIRECT, blocks and so the offsets are multiples of the alignment
+			if (m_direct)
+				m_block_size = align_up(m_block_size);
+			if (m_fd >= 0 && !m_engine.open(m_fd, m_block_size, m_queue_depth))
+			{
+				::close(m_fd);
+				m_fd = -1;
+			}
+		}
+		// writes out the partly filled block and waits for all the writes
+		void flush()
+		{
+			if (m_fd < 0)
+				return;
+			block_io_engine::block& b = m_engine[m_cur];
+			if (b.size > 0 && m_direct)
+			{
+				// the next write must start at an aligned offset, so the block
+				// is written padded and stays to be filled up and written again
+				size_t size = b.size;
+				start_write(size);
+				m_engine.submit();
+				m_engine.wait(m_cur);
+				b.size = size;
+			}
+			else if (b.size > 0)
+				dispatch();
+			m_engine.wait_all();
+			if (m_engine.error() != 0)
+				throw std::runtime_error("Write Error!");
+		}
+		// writes out the last block, waits for all the writes and closes the
+		// file; returns false when a write failed. It does not throw.
+		bool close()
+		{
+			bool ok = true;
+			if (m_fd >= 0)
+			{
+				block_io_engine::block& b = m_engine[m_cur];
+				uint64_t end = m_offset + b.size;
+				if (b.size > 0)
+				{
+					start_write(b.size);
+					m_engine.submit();
+				}
+				m_engine.wait_all();
+				ok = m_engine.error() == 0;
+				m_engine.close();
+				// cuts off the padding of the last block
+				if (m_direct && end % direct_alignment != 0 && ::ftruncate(m_fd, (off_t)end) != 0)
+					ok = false;
+				if (::close(m_fd) != 0)
+					ok = false;
+				m_fd = -1;
+			}
+			m_cur = 0; m_offset = 0; m_direct = false;
+			return ok;
+		}
+		bool is_open() const
+		{
+			return m_fd >= 0;
+		}
+		// true when hint_direct was given and the file system accepted O_DIRECT
+		bool is_direct() const
+		{
+			return m_direct;
+		}
+		bool uses_io_uring() const
+		{
+			return m_engine.uses_io_uring();
+		}
+
+	protected:
+		// writes nothing when the file or the engine failed to open
+		void put(const char* p, size_t size)
+		{
+			if (m_fd < 0)
+				return;
+			while (size > 0)
+			{
+				block_io_engine::block& b = m_engine[m_cur];
+				size_t n = m_block_size - b.size;
+				if (n > size)
+					n = size;
+				std::memcpy(b.data + b.size, p, n);
+				b.size += n;
+				p += n;
+				size -= n;
+				if (b.size == m_block_size)
+					dispatch();
+			}
+		}
+
+	private:
+		uring_sink(const uring_sink&);
+		uring_sink& operator=(const uring_sink&);
+
+		// hands the current block to the engine and moves on to the next free one
+		void dispatch()
+		{
+			size_t size = m_engine[m_cur].size;
+			start_write(size);
+			m_engine.submit();
+			m_offset += size;
+			m_cur = (m_cur + 1) % m_engine.count();
+			m_engine.wait(m_cur);
+			if (m_engine.error() != 0)
+				throw std::runtime_error("Write Error!");
+			m_engine[m_cur].size = 0;
+		}
+
+		// starts the write of the current block, with O_DIRECT padded with zeros
+		// to the alignment
+		void start_write(size_t size)
+		{
+			block_io_engine::block& b = m_engine[m_cur];
+			size_t length = m_direct ? align_up(size) : size;
+			if (length > size)
+				std::memset(b.data + size, 0, length - size);
+			m_engine.start(m_cur, m_offset, length, true);
+		}
+
+		int m_fd;
+		size_t m_block_size;
+		unsigned m_queue_depth;
+		unsigned m_cur;
+		uint64_t m_offset;
+		unsigned m_hints;
+		bool m_direct;
+		block_io_engine m_engine;
+	};
+
+	// reads through a block_io_engine, which reads ahead into the free blocks
+	class uring_source
+	{
+	public:
+		// hints is hint_none or hint_direct; queue_depth is at least 2, so that
+		// one block is read from while another is read ahead
+		uring_source(size_t block_size = 1 << 20, unsigned queue_depth = 4, unsigned hints = hint_none)
+			: m_fd(-1), m_block_size(block_size), m_queue_depth(queue_depth < 2 ? 2 : queue_depth), m_cur(0), m_pos(0), m_next_offset(0), m_file_size(0), m_queued(0), m_hints(hints), m_direct(false) {}
+		uring_source(const char * file, size_t block_size = 1 << 20, unsigned queue_depth = 4, unsigned hints = hint_none)
+			: m_fd(-1), m_block_size(block_size), m_queue_depth(queue_depth < 2 ? 2 : queue_depth), m_cur(0), m_pos(0), m_next_offset(0), m_file_size(0), m_queued(0), m_hints(hints), m_direct(false)
+		{
+			open(file);
+		}
+		~uring_source()
+		{
+			close();
+		}
+		void open(const char * file)
+		{
+			open(file, m_hints);
+		}
+		void open(const char * file, unsigned hints)
+		{
+			close();
+			m_hints = hints;
+			if (hints & hint_direct)
+				m_fd = open_direct(file, O_RDONLY, m_direct);
+			else
+				m_fd = ::open(file, O_RDONLY);
+			if (m_fd < 0)
+				return;
+			if (m_direct)
+				m_block_size = align_up(m_block_size);
+			struct stat st;
+			if (::fstat(m_fd, &st) != 0 || !m_engine.open(m_fd, m_block_size, m_queue_depth))
+			{
+				::close(m_fd);
+				m_fd = -1;
+				return;
+			}
+			m_file_size = (uint64_t)st.st_size;
+			restart(0);
+		}
+		void close()
+		{
+			if (m_fd >= 0)
+			{
+				m_engine.close();
+				::close(m_fd);
+				m_fd = -1;
+			}
+			m_cur = 0; m_pos = 0; m_next_offset = 0; m_file_size = 0; m_queued = 0; m_direct = false;
+		}
+		bool is_open() const
+		{
+			return m_fd >= 0;
+		}
+		// true when hint_direct was given and the file system accepted O_DIRECT
+		bool is_direct() const
+		{
+			return m_direct;
+		}
+		bool uses_io_uring() const
+		{
+			return m_engine.uses_io_uring();
+		}
+		uint64_t file_length() const
+		{
+			return m_file_size;
+		}
+		bool eof() const
+		{
+			return m_pos >= m_file_size;
+		}
+		uint64_t remaining() const
+		{
+			return (m_pos < m_file_size) ? m_file_size - m_pos : 0;
+		}
+		uint64_t tellg() const
+		{
+			return m_pos;
+		}
+		bool seekg(uint64_t pos)
+		{
+			if (m_fd < 0 || pos > m_file_size)
+				return false;
+			m_engine.wait_all();
+			restart(pos);
+			return true;
+		}
+
+	protected:
+		bool fetch(char* p, size_t size)
+		{
+			return consume(p, size);
+		}
+		bool discard(size_t size)
+		{
+			if (m_pos + size > m_file_size)
+				return false;
+
+			// a long jump restarts the reads at the target instead of waiting for the blocks in between
+			if (size > (uint64_t)m_block_size * m_engine.count())
+				return seekg(m_pos + size);
+			return consume(nullptr, size);
+		}
+		bool look(char* p, size_t size)
+		{
+			if (m_pos + size > m_file_size || !ready())
+				return false;
+
+			block_io_engine::block& b = m_engine[m_cur];
+			size_t index = (size_t)(m_pos - b.offset);
+			if (index + size <= b.size)
+			{
+				std::memcpy(reinterpret_cast<void*>(p), b.data + index, size);
+				return true;
+			}
+			// the bytes run into the next block, whose reads are restarted
+			uint64_t pos = m_pos;
+			return consume(p, size) && seekg(pos);
+		}
+		void fail() const
+		{
+			throw std::runtime_error("Read Error!");
+		}
+
+	private:
+		uring_source(const uring_source&);
+		uring_source& operator=(const uring_source&);
+
+		// waits for the current block; false when a read failed
+		bool ready()
+		{
+			if (m_engine[m_cur].busy)
+			{
+				m_engine.wait(m_cur);
+				m_queued = 0;
+			}
+			return m_engine.error() == 0;
+		}
+		// copies the next size bytes to p, or just steps over them when p is null
+		bool consume(char* p, size_t size)
+		{
+			if (m_pos + size > m_file_size)
+				return false;
+
+			while (size > 0)
+			{
+				if (!ready())
+					return false;
+				block_io_engine::block& b = m_engine[m_cur];
+				size_t index = (size_t)(m_pos - b.offset);
+				size_t n = b.size - index;
+				if (n > size)
+					n = size;
+				if (p)
+				{
+					std::memcpy(p, b.data + index, n);
+					p += n;
+				}
+				m_pos += n;
+				size -= n;
+				if (index + n == b.size)
+				{
+					// the block is used up, refill it with the next unread one
+					schedule(m_cur);
+					m_cur = (m_cur + 1) % m_engine.count();
+				}
+			}
+			return true;
+		}
+		void restart(uint64_t pos)
+		{
+			m_pos = pos;
+			m_next_offset = pos - pos % m_block_size;
+			m_cur = 0;
+			m_queued = 0;
+			for (unsigned i = 0; i < m_engine.count(); ++i)
+				schedule(i);
+			m_engine.submit();
+			m_queued = 0;
+		}
+		void schedule(unsigned i)
+		{
+			uint64_t left = m_file_size - m_next_offset;
+			size_t size = (left < m_block_size) ? (size_t)left : m_block_size;
+			// with O_DIRECT the tail is read with an aligned size, which ends at the end of the file
+			m_engine.start(i, m_next_offset, m_direct ? align_up(size) : size, false);
+			m_next_offset += size;
+			// reads are handed to the kernel in batches of half the queue
+			if (size > 0 && ++m_queued * 2 >= m_engine.count())
+			{
+				m_engine.submit();
+				m_queued = 0;
+			}
+		}
+
+		int m_fd;
+		size_t m_block_size;
+		unsigned m_queue_depth;
+		unsigned m_cur;
+		uint64_t m_pos;
+		uint64_t m_next_offset;
+		uint64_t m_file_size;
+		unsigned m_queued;
+		unsigned m_hints;
+		bool m_direct;
+		block_io_engine m_engine;
+	};
+} // ns detail
+
+// uring_file_ostream and uring_file_istream keep several blocks in flight,
+// so encoding of the next block overlaps the write of the previous one,
+// and reading runs ahead of decoding. On Linux the transfers go through
+// io_uring; elsewhere, or when io_uring is unavailable, through pwrite/pread.
+// They are opened with (file, block_size, queue_depth, hints). The blocks
+// are not one piece of memory, so there is no ensure() for the unchecked reads.
+template<typename same_endian_type>
+using uring_file_ostream = basic_bin_ostream<detail::uring_sink, same_endian_type>;
+
+template<typename same_endian_type>
+using uring_file_istream = basic_bin_istream<detail::uring_source, same_endian_type>;
+#endif // SIMPLE_BINSTREAM_POSIX
+
+#ifdef SIMPLE_BINSTREAM_COROUTINE
+// A positional read or write handed to an async_io_backend. The backend
+// stores the byte count (or -errno) in result and then calls on_complete,
+// which may submit the request again to continue a short transfer.
+struct async_io_request
+{
+	enum op_type { op_read, op_write };
+
+	op_type op;
+	int fd;
+	char* buf;
+	size_t size;
+	uint64_t offset;
+	long long result;
+	void (*on_complete)(async_io_request*);
+	void* context;
+};
+
+class async_io_backend
+{
+public:
+	virtual ~async_io_backend() {}
+	virtual void submit(async_io_request& req) = 0;
+};
+
+class thread_pool_backend : public async_io_backend
+{
+public:
+	thread_pool_backend(unsigned threads = 2) : m_stop(false)
+	{
+		if (threads == 0)
+			threads = 1;
+		for (unsigned i = 0; i < threads; ++i)
+			m_threads.emplace_back([this] { run(); });
+	}
+	~thread_pool_backend()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_cond.notify_all();
+		for (size_t i = 0; i < m_threads.size(); ++i)
+			m_threads[i].join();
+	}
+	void submit(async_io_request& req) override
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_queue.push_back(&req);
+		}
+		m_cond.notify_one();
+	}
+
+private:
+	void run()
+	{
+		while (true)
+		{
+			async_io_request* req = nullptr;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cond.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+				if (m_queue.empty())
+					return;
+				req = m_queue.front();
+				m_queue.pop_front();
+			}
+			ssize_t ret = (req->op == async_io_request::op_read)
+				? ::pread(req->fd, req->buf, req->size, (off_t)req->offset)
+				: ::pwrite(req->fd, req->buf, req->size, (off_t)req->offset);
+			req->result = (ret < 0) ? -errno : ret;
+			req->on_complete(req);
+		}
+	}
+
+	std::vector<std::thread> m_threads;
+	std::deque<async_io_request*> m_queue;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	bool m_stop;
+};
+
+#ifdef SIMPLE_BINSTREAM_IO_URING
+class io_uring_backend : public async_io_backend
+{
+public:
+	io_uring_backend(unsigned entries = 64)
+	{
+		if (m_ring.open(entries))
+			m_thread = std::thread([this] { run(); });
+	}
+	~io_uring_backend()
+	{
+		if (!m_ring.is_open())
+			return;
+		// a nop with no request wakes the completion thread up
+		do
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			io_uring_sqe* sqe = next_sqe();
+			sqe->opcode = IORING_OP_NOP;
+			sqe->user_data = 0;
+		} while (flush(true) < 0);
+		m_thread.join();
+	}
+	bool is_open() const
+	{
+		return m_ring.is_open();
+	}
+	void submit(async_io_request& req) override
 	{
-		if (eof())
-			throw std::runtime_error("Premature end of array!");
-
-		if ((m_index + size) > m_size)
-			throw std::runtime_error("Premature end of array!");
-
-		str.assign(&m_arr[m_index], size);
-
-		m_index += str.size();
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			io_uring_sqe* sqe = next_sqe();
+			sqe->opcode = (req.op == async_io_request::op_read) ? IORING_OP_READ : IORING_OP_WRITE;
+			sqe->fd = req.fd;
+			sqe->addr = reinterpret_cast<uint64_t>(req.buf);
+			sqe->len = (unsigned)req.size;
+			sqe->off = req.offset;
+			sqe->user_data = reinterpret_cast<uint64_t>(&req);
+		}
+		// the completion thread must not wait for itself to reap completions;
+		// what it queues is handed over after its batch
+		flush(std::this_thread::get_id() != m_thread.get_id());
 	}
 
 private:
-	void compute_length(std::FILE* input_file_ptr)
+	io_uring_sqe* next_sqe()
+	{
+		io_uring_sqe* sqe = m_ring.get_sqe();
+		while (sqe == nullptr)
+		{
+			std::this_thread::yield();
+			sqe = m_ring.get_sqe();
+		}
+		return sqe;
+	}
+	// Hands the queued entries to the kernel. It may take part of them, or
+	// none while it is short of resources (-EAGAIN) or has too many
+	// completions unreaped (-EBUSY); with retry these are tried again,
+	// without holding the lock. On any other error the requests not taken
+	// are completed with it. Returns 0 when all were taken, 1 when some are
+	// left for later and the error otherwise.
+	int flush(bool retry)
+	{
+		std::vector<async_io_request*> failed;
+		int status = 0;
+		while (true)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_ring.pending() == 0)
+					break;
+				int ret = m_ring.submit();
+				if (ret < 0 && ret != -EAGAIN && ret != -EBUSY)
+				{
+					status = ret;
+					m_ring.withdraw([&failed](uint64_t data) { failed.push_back(reinterpret_cast<async_io_request*>(data)); });
+					break;
+				}
+				if (m_ring.pending() == 0)
+					break;
+				if (!retry)
+				{
+					status = 1;
+					break;
+				}
+			}
+			std::this_thread::yield();
+		}
+		// outside the lock, as a completion may submit again
+		for (size_t i = 0; i < failed.size(); ++i)
+		{
+			if (failed[i] == nullptr)
+				continue;
+			failed[i]->result = status;
+			failed[i]->on_complete(failed[i]);
+		}
+		return status;
+	}
+	void run()
 	{
-		std::fseek(input_file_ptr, 0, SEEK_END);
-		m_size = std::ftell(input_file_ptr);
-		std::fseek(input_file_ptr, 0, SEEK_SET);
+		io_uring_cqe cqe;
+		bool stop = false;
+		int left = 0;
+		while (!stop)
+		{
+			if (left > 0)
+				std::this_thread::yield();
+			else
+				m_ring.wait(1);
+			// the whole batch is completed, also after the nop which stops the thread
+			while (m_ring.peek_cqe(cqe))
+			{
+				if (cqe.user_data == 0)
+				{
+					stop = true;
+					continue;
+				}
+				async_io_request* req = reinterpret_cast<async_io_request*>(cqe.user_data);
+				req->result = cqe.res;
+				req->on_complete(req);
+			}
+			left = flush(false);
+		}
 	}
 
-	char* m_arr;
-	size_t m_size;
-	size_t m_index;
-	same_endian_type m_same_type;
+	detail::io_uring_queue m_ring;
+	std::thread m_thread;
+	std::mutex m_mutex;
 };
+#endif // SIMPLE_BINSTREAM_IO_URING
 
-
-template<typename same_endian_type, typename T>
- memfile_istream<same_endian_type>& operator >> ( memfile_istream<same_endian_type>& istm, T& val)
+// io_uring when the kernel supports it, otherwise a small thread pool
+inline std::shared_ptr<async_io_backend> make_async_io_backend()
 {
-	istm.read(val);
-
-	return istm;
+#ifdef SIMPLE_BINSTREAM_IO_URING
+	std::shared_ptr<io_uring_backend> ring = std::make_shared<io_uring_backend>();
+	if (ring->is_open())
+		return ring;
+#endif
+	return std::make_shared<thread_pool_backend>();
 }
 
-template<typename same_endian_type>
- memfile_istream<same_endian_type>& operator >> ( memfile_istream<same_endian_type>& istm, std::string& val)
+inline std::shared_ptr<async_io_backend> default_async_io_backend()
 {
-	val.clear();
-
-	int size = 0;
-	istm.read(size);
-
-	if (size <= 0)
-		return istm;
-
-	istm.read(val, size);
-
-	return istm;
+	static std::shared_ptr<async_io_backend> backend = make_async_io_backend();
+	return backend;
 }
 
+// async_file_istream and async_file_ostream are awaited from a coroutine:
+// co_await in.read(x) completes without suspending while x is buffered and
+// only suspends to refill the buffer through the backend. The coroutine is
+// resumed on the backend's completion thread. Only one operation may be in
+// flight per stream.
 template<typename same_endian_type>
-class file_ostream
+class async_file_istream
 {
 public:
-	file_ostream() : output_file_ptr(nullptr) {}
-	file_ostream(const char * file) : output_file_ptr(nullptr)
-	{
-		open(file);
-	}
-#ifdef _MSC_VER
-	file_ostream(const wchar_t * file) : output_file_ptr(nullptr)
+	async_file_istream(std::shared_ptr<async_io_backend> backend = default_async_io_backend(), size_t buffer_size = 64 * 1024)
+		: m_backend(backend), m_fd(-1), m_buf(buffer_size), m_begin(0), m_end(0), m_file_offset(0), m_file_size(0), m_error(0), m_wanted(nullptr) {}
+	async_file_istream(const char * file, std::shared_ptr<async_io_backend> backend = default_async_io_backend(), size_t buffer_size = 64 * 1024)
+		: m_backend(backend), m_fd(-1), m_buf(buffer_size), m_begin(0), m_end(0), m_file_offset(0), m_file_size(0), m_error(0), m_wanted(nullptr)
 	{
 		open(file);
 	}
-#endif
-	~file_ostream()
+	~async_file_istream()
 	{
 		close();
 	}
 	void open(const char * file)
 	{
 		close();
-#ifdef _MSC_VER
-		output_file_ptr = nullptr;
-		fopen_s(&output_file_ptr, file, "wb");
-#else
-		output_file_ptr = std::fopen(file, "wb");
-#endif
-	}
-#ifdef _MSC_VER
-	void open(const wchar_t * file)
-	{
-		close();
-		output_file_ptr = nullptr;
-		_wfopen_s(&output_file_ptr, file, L"wb");
-	}
-#endif
-	void flush()
-	{
-		std::fflush(output_file_ptr);
+		m_fd = ::open(file, O_RDONLY);
+		struct stat st;
+		if (m_fd >= 0 && ::fstat(m_fd, &st) == 0)
+			m_file_size = (uint64_t)st.st_size;
 	}
 	void close()
 	{
-		if (output_file_ptr)
+		if (m_fd >= 0)
 		{
-			std::fclose(output_file_ptr);
-			output_file_ptr = nullptr;
+			::close(m_fd);
+			m_fd = -1;
 		}
+		m_begin = m_end = 0; m_file_offset = m_file_size = 0; m_error = 0;
 	}
-	bool is_open()
+	bool is_open() const
 	{
-		return output_file_ptr != nullptr;
+		return m_fd >= 0;
 	}
-	template<typename T>
-	void write(const T& t)
+	uint64_t file_length() const
 	{
-		T t2 = t;
-		simple::swap_endian_if_same_endian_is_false(t2, m_same_type);
-		std::fwrite(reinterpret_cast<const void*>(&t2), sizeof(T), 1, output_file_ptr);
+		return m_file_size;
 	}
-	void write(const std::vector<char>& vec)
+	uint64_t tellg() const
 	{
-		std::fwrite(reinterpret_cast<const void*>(&vec[0]), vec.size(), 1, output_file_ptr);
+		return m_file_offset - available();
 	}
-	void write(const char* p, size_t size)
+	bool eof() const
 	{
-		std::fwrite(reinterpret_cast<const void*>(p), size, 1, output_file_ptr);
+		return tellg() >= m_file_size;
 	}
 
-private:
-	std::FILE* output_file_ptr;
-	same_endian_type m_same_type;
-};
-
-template<typename same_endian_type, typename T>
-file_ostream<same_endian_type>& operator << (file_ostream<same_endian_type>& ostm, const T& val)
-{
-	ostm.write(val);
-
-	return ostm;
-}
-
-template<typename same_endian_type>
- file_ostream<same_endian_type>& operator << ( file_ostream<same_endian_type>& ostm, const std::string& val)
-{
-	int size = val.size();
-	ostm.write(size);
-
-	if(val.size()<=0)
-		return ostm;
-
-	ostm.write(val.c_str(), val.size());
-
-	return ostm;
-}
-
-template<typename same_endian_type>
- file_ostream<same_endian_type>& operator << ( file_ostream<same_endian_type>& ostm, const char* val)
-{
-	int size = std::strlen(val);
-	ostm.write(size);
+	template<typename T>
+	class read_awaiter
+	{
+	public:
+		read_awaiter(async_file_istream& stm, T& val) : m_stm(stm), m_val(val) {}
+		bool await_ready()
+		{
+			return m_stm.available() >= wanted(m_stm);
+		}
+		bool await_suspend(std::coroutine_handle<> handle)
+		{
+			return m_stm.start_refill(handle, &read_awaiter::wanted);
+		}
+		void await_resume()
+		{
+			if (m_stm.m_error != 0 || m_stm.available() < wanted(m_stm))
+				throw std::runtime_error("Read Error!");
+			m_stm.take(m_val);
+		}
 
-	if(size<=0)
-		return ostm;
+	private:
+		static size_t wanted(const async_file_istream& stm)
+		{
+			return stm.bytes_wanted(static_cast<T*>(nullptr));
+		}
 
-	ostm.write(val, size);
+		async_file_istream& m_stm;
+		T& m_val;
+	};
 
-	return ostm;
-}
+	template<typename T>
+	read_awaiter<T> read(T& t)
+	{
+		return read_awaiter<T>(*this, t);
+	}
 
-template<typename same_endian_type>
-class mem_ostream
-{
-public:
-	mem_ostream() {}
-	void close()
+private:
+	size_t available() const
 	{
-		m_vec.clear();
+		return m_end - m_begin;
 	}
-	const std::vector<char>& get_internal_vec()
+	template<typename T>
+	size_t bytes_wanted(T*) const
+	{
+		return sizeof(T);
+	}
+	size_t bytes_wanted(std::string*) const
 	{
-		return m_vec;
+		if (available() < sizeof(int))
+			return sizeof(int);
+		int size = 0;
+		std::memcpy(&size, &m_buf[m_begin], sizeof(int));
+		simple::swap_endian_if_same_endian_is_false(size, m_same_type);
+		return sizeof(int) + (size > 0 ? (size_t)size : 0);
 	}
 	template<typename T>
-	void write(const T& t)
+	void take(T& t)
 	{
-		std::vector<char> vec(sizeof(T));
-		T t2 = t;
-		simple::swap_endian_if_same_endian_is_false(t2, m_same_type);
-		std::memcpy(reinterpret_cast<void*>(&vec[0]), reinterpret_cast<const void*>(&t2), sizeof(T));
-		write(vec);
+		std::memcpy(reinterpret_cast<void*>(&t), &m_buf[m_begin], sizeof(T));
+		simple::swap_endian_if_same_endian_is_false(t, m_same_type);
+		m_begin += sizeof(T);
 	}
-	void write(const std::vector<char>& vec)
+	void take(std::string& str)
 	{
-		m_vec.insert(m_vec.end(), vec.begin(), vec.end());
+		int size = 0;
+		take(size);
+		str.clear();
+		if (size <= 0)
+			return;
+		str.assign(&m_buf[m_begin], (size_t)size);
+		m_begin += (size_t)size;
 	}
-	void write(const char* p, size_t size)
+	bool start_refill(std::coroutine_handle<> handle, size_t (*wanted)(const async_file_istream&))
 	{
-		for(size_t i=0; i<size; ++i)
-			m_vec.push_back(p[i]);
+		m_waiter = handle;
+		m_wanted = wanted;
+		return submit_refill();
 	}
-	template<typename T>
-	void writeat(size_t pos, const T& t)
+	// returns false without submitting when the file cannot hold what is wanted,
+	// so a corrupt length prefix fails the read instead of sizing the buffer
+	bool submit_refill()
 	{
-		std::vector<char> vec(sizeof(T));
-		T t2 = t;
-		simple::swap_endian_if_same_endian_is_false(t2, m_same_type);
-		std::memcpy(reinterpret_cast<void*>(&vec[0]), reinterpret_cast<const void*>(&t2), sizeof(T));
-		writeat(pos, vec);
+		size_t want = m_wanted(*this);
+		uint64_t pos = tellg();
+		if (pos >= m_file_size || want > m_file_size - pos)
+			return false;
+		if (m_begin > 0)
+		{
+			std::memmove(&m_buf[0], &m_buf[m_begin], available());
+			m_end -= m_begin;
+			m_begin = 0;
+		}
+		if (want > m_buf.size())
+			m_buf.resize(want);
+
+		m_req.op = async_io_request::op_read;
+		m_req.fd = m_fd;
+		m_req.buf = &m_buf[m_end];
+		m_req.size = m_buf.size() - m_end;
+		m_req.offset = m_file_offset;
+		m_req.result = 0;
+		m_req.on_complete = &async_file_istream::on_refill;
+		m_req.context = this;
+		m_backend->submit(m_req);
+		return true;
 	}
-
-	void writeat(size_t pos, const std::vector<char>& vec)
+	static void on_refill(async_io_request* req)
 	{
-		for (size_t n = 0, count = vec.size(); n < count; n++)
-			m_vec[pos++] = vec[n];
+		async_file_istream* stm = static_cast<async_file_istream*>(req->context);
+		if (req->result < 0)
+			stm->m_error = (int)-req->result;
+		else if (req->result > 0)
+		{
+			stm->m_end += (size_t)req->result;
+			stm->m_file_offset += (uint64_t)req->result;
+			if (stm->available() < stm->m_wanted(*stm) && stm->submit_refill())
+				return;
+		}
+		std::coroutine_handle<> handle = stm->m_waiter;
+		stm->m_waiter = nullptr;
+		handle.resume();
 	}
-private:
-	std::vector<char> m_vec;
+
+	std::shared_ptr<async_io_backend> m_backend;
+	int m_fd;
+	std::vector<char> m_buf;
+	size_t m_begin;
+	size_t m_end;
+	uint64_t m_file_offset;
+	uint64_t m_file_size;
+	int m_error;
+	async_io_request m_req;
+	std::coroutine_handle<> m_waiter;
+	size_t (*m_wanted)(const async_file_istream&);
 	same_endian_type m_same_type;
 };
 
-template<typename same_endian_type, typename T>
- mem_ostream<same_endian_type>& operator << ( mem_ostream<same_endian_type>& ostm, const T& val)
-{
-	ostm.write(val);
-
-	return ostm;
-}
-
 template<typename same_endian_type>
- mem_ostream<same_endian_type>& operator << ( mem_ostream<same_endian_type>& ostm, const std::string& val)
+class async_file_ostream
 {
-	int size = val.size();
-	ostm.write(size);
-
-	if(val.size()<=0)
-		return ostm;
-
-	ostm.write(val.c_str(), val.size());
-
-	return ostm;
-}
+public:
+	async_file_ostream(std::shared_ptr<async_io_backend> backend = default_async_io_backend(), size_t buffer_size = 64 * 1024)
+		: m_backend(backend), m_fd(-1), m_capacity(buffer_size), m_written(0), m_file_offset(0), m_error(0)
+	{
+		m_buf.reserve(m_capacity);
+	}
+	async_file_ostream(const char * file, std::shared_ptr<async_io_backend> backend = default_async_io_backend(), size_t buffer_size = 64 * 1024)
+		: m_backend(backend), m_fd(-1), m_capacity(buffer_size), m_written(0), m_file_offset(0), m_error(0)
+	{
+		m_buf.reserve(m_capacity);
+		open(file);
+	}
+	~async_file_ostream()
+	{
+		close();
+	}
+	void open(const char * file)
+	{
+		close();
+		m_fd = ::open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	// writes out what is still buffered synchronously, returns false if
+	// that or an earlier write failed; the destructor ignores the result
+	bool close()
+	{
+		bool ok = (m_error == 0);
+		if (m_fd >= 0)
+		{
+			size_t done = 0;
+			while (ok && done < m_buf.size())
+			{
+				ssize_t ret = ::pwrite(m_fd, &m_buf[done], m_buf.size() - done, (off_t)(m_file_offset + done));
+				if (ret < 0 && errno == EINTR)
+					continue;
+				if (ret <= 0)
+					ok = false;
+				else
+					done += (size_t)ret;
+			}
+			if (::close(m_fd) != 0)
+				ok = false;
+			m_fd = -1;
+		}
+		m_buf.clear();
+		m_file_offset = 0; m_error = 0;
+		return ok;
+	}
+	bool is_open() const
+	{
+		return m_fd >= 0;
+	}
 
-template<typename same_endian_type>
- mem_ostream<same_endian_type>& operator << ( mem_ostream<same_endian_type>& ostm, const char* val)
-{
-	int size = std::strlen(val);
-	ostm.write(size);
+	template<typename T>
+	class write_awaiter
+	{
+	public:
+		write_awaiter(async_file_ostream& stm, const T& val) : m_stm(stm), m_val(val) {}
+		bool await_ready()
+		{
+			return m_stm.m_buf.empty() || m_stm.m_buf.size() + m_stm.bytes_needed(m_val) <= m_stm.m_capacity;
+		}
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			m_stm.start_flush(handle);
+		}
+		void await_resume()
+		{
+			if (m_stm.m_error != 0)
+				throw std::runtime_error("Write Error!");
+			m_stm.put(m_val);
+		}
 
-	if(size<=0)
-		return ostm;
+	private:
+		async_file_ostream& m_stm;
+		const T& m_val;
+	};
 
-	ostm.write(val, size);
+	class flush_awaiter
+	{
+	public:
+		flush_awaiter(async_file_ostream& stm) : m_stm(stm) {}
+		bool await_ready()
+		{
+			return m_stm.m_buf.empty();
+		}
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			m_stm.start_flush(handle);
+		}
+		void await_resume()
+		{
+			if (m_stm.m_error != 0)
+				throw std::runtime_error("Write Error!");
+		}
 
-	return ostm;
-}
+	private:
+		async_file_ostream& m_stm;
+	};
 
-template<typename same_endian_type>
-class memfile_ostream
-{
-public:
-	memfile_ostream() {}
-	void close()
+	template<typename T>
+	write_awaiter<T> write(const T& t)
 	{
-		m_vec.clear();
+		return write_awaiter<T>(*this, t);
 	}
-	const std::vector<char>& get_internal_vec()
+	write_awaiter<std::string> write(const char* str)
 	{
-		return m_vec;
+		m_str = str;
+		return write_awaiter<std::string>(*this, m_str);
 	}
-	template<typename T>
-	void write(const T& t)
+	flush_awaiter flush()
 	{
-		std::vector<char> vec(sizeof(T));
-		T t2 = t;
-		simple::swap_endian_if_same_endian_is_false(t2, m_same_type);
-		std::memcpy(reinterpret_cast<void*>(&vec[0]), reinterpret_cast<const void*>(&t2), sizeof(T));
-		write(vec);
+		return flush_awaiter(*this);
 	}
-	void write(const std::vector<char>& vec)
+
+private:
+	template<typename T>
+	size_t bytes_needed(const T&) const
 	{
-		m_vec.insert(m_vec.end(), vec.begin(), vec.end());
+		return sizeof(T);
 	}
-	void write(const char* p, size_t size)
+	size_t bytes_needed(const std::string& str) const
 	{
-		for (size_t i = 0; i<size; ++i)
-			m_vec.push_back(p[i]);
+		return sizeof(int) + str.size();
 	}
 	template<typename T>
-	void writeat(size_t pos, const T& t)
+	void put(const T& t)
 	{
-		std::vector<char> vec(sizeof(T));
 		T t2 = t;
 		simple::swap_endian_if_same_endian_is_false(t2, m_same_type);
-		std::memcpy(reinterpret_cast<void*>(&vec[0]), reinterpret_cast<const void*>(&t2), sizeof(T));
-		writeat(pos, vec);
+		const char* p = reinterpret_cast<const char*>(&t2);
+		m_buf.insert(m_buf.end(), p, p + sizeof(T));
 	}
-
-	void writeat(size_t pos, const std::vector<char>& vec)
+	void put(const std::string& str)
 	{
-		for (size_t n = 0, count = vec.size(); n < count; n++)
-			m_vec[pos++] = vec[n];
+		put((int)str.size());
+		m_buf.insert(m_buf.end(), str.begin(), str.end());
 	}
-	bool write_to_file(const char* file)
+	void start_flush(std::coroutine_handle<> handle)
 	{
-#ifdef _MSC_VER
-		std::FILE* fp = nullptr;
-		fopen_s(&fp, file, "wb");
-#else
-		std::FILE* fp = std::fopen(file, "wb");
-#endif
-		if (fp)
-		{
-			size_t size = std::fwrite(m_vec.data(), m_vec.size(), 1, fp);
-			std::fflush(fp);
-			std::fclose(fp);
-			m_vec.clear();
-			return size == 1u;
-		}
-		return false;
+		m_waiter = handle;
+		m_written = 0;
+		submit_write();
 	}
-#ifdef _MSC_VER
-	bool write_to_file(const wchar_t* file)
+	void submit_write()
 	{
-		std::FILE* fp = nullptr;
-		_wfopen_s(&fp, file, L"wb");
-		if (fp)
+		m_req.op = async_io_request::op_write;
+		m_req.fd = m_fd;
+		m_req.buf = &m_buf[m_written];
+		m_req.size = m_buf.size() - m_written;
+		m_req.offset = m_file_offset + m_written;
+		m_req.result = 0;
+		m_req.on_complete = &async_file_ostream::on_written;
+		m_req.context = this;
+		m_backend->submit(m_req);
+	}
+	static void on_written(async_io_request* req)
+	{
+		async_file_ostream* stm = static_cast<async_file_ostream*>(req->context);
+		if (req->result <= 0)
+			stm->m_error = req->result < 0 ? (int)-req->result : EIO;
+		else
 		{
-			size_t size = std::fwrite(m_vec.data(), m_vec.size(), 1, fp);
-			std::fflush(fp);
-			std::fclose(fp);
-			m_vec.clear();
-			return size == 1u;
+			stm->m_written += (size_t)req->result;
+			if (stm->m_written < stm->m_buf.size())
+			{
+				stm->submit_write();
+				return;
+			}
+			stm->m_file_offset += stm->m_buf.size();
+			stm->m_buf.clear();
 		}
-		return false;
+		std::coroutine_handle<> handle = stm->m_waiter;
+		stm->m_waiter = nullptr;
+		handle.resume();
 	}
-#endif
 
-private:
-	std::vector<char> m_vec;
+	std::shared_ptr<async_io_backend> m_backend;
+	int m_fd;
+	std::vector<char> m_buf;
+	size_t m_capacity;
+	size_t m_written;
+	uint64_t m_file_offset;
+	int m_error;
+	std::string m_str;
+	async_io_request m_req;
+	std::coroutine_handle<> m_waiter;
 	same_endian_type m_same_type;
 };
-
-template<typename same_endian_type, typename T>
- memfile_ostream<same_endian_type>& operator << ( memfile_ostream<same_endian_type>& ostm, const T& val)
-{
-	ostm.write(val);
-
-	return ostm;
-}
-
-template<typename same_endian_type>
- memfile_ostream<same_endian_type>& operator << ( memfile_ostream<same_endian_type>& ostm, const std::string& val)
-{
-	int size = val.size();
-	ostm.write(size);
-
-	if (val.size() <= 0)
-		return ostm;
-
-	ostm.write(val.c_str(), val.size());
-
-	return ostm;
-}
-
-template<typename same_endian_type>
- memfile_ostream<same_endian_type>& operator << ( memfile_ostream<same_endian_type>& ostm, const char* val)
-{
-	int size = std::strlen(val);
-	ostm.write(size);
-
-	if (size <= 0)
-		return ostm;
-
-	ostm.write(val, size);
-
-	return ostm;
-}
+#endif // SIMPLE_BINSTREAM_COROUTINE
 
 } // ns simple
 
@@ -2,6 +2,8 @@
 //
 
 #include <iostream>
+#include <algorithm>
+#include <future>
 #include "SimpleBinStream.h"
 #include "CustomOperators.h"
 
@@ -18,12 +20,90 @@ void TestMemCustomOperators();
 void TestMemPtrCustomOperators();
 void TestFileCustomOperators();
 void TestMemFileCustomOperators();
+void TestChunk();
+void TestAsyncFile();
+void TestUringFile();
+void TestAsyncFlush();
+void TestBitwiseStructs();
+void TestContainers();
+void TestColumnar();
+void TestSkipPeek();
+void TestPmr();
+void TestAllocator();
+void TestOstreamPool();
+void TestSizeStream();
+void TestWriteAll();
+void TestReadWindow();
+void TestStreamCore();
+void TestPtrOstream();
+void TestSmallOstream();
+void TestRopeOstream();
+void TestSegmented();
+void TestSharedBuffer();
+void TestPositional();
+void TestLargeFile();
+void TestFileHints();
+void TestDirectIO();
+void TestPrefetch();
+void TestCorruptLength();
 
 using namespace std;
 int main(int argc, char* argv[])
 {
 	TestMissingString();
 	std::cout << "=============" << std::endl;
+	TestChunk();
+	std::cout << "=============" << std::endl;
+	TestAsyncFile();
+	std::cout << "=============" << std::endl;
+	TestUringFile();
+	std::cout << "=============" << std::endl;
+	TestAsyncFlush();
+	std::cout << "=============" << std::endl;
+	TestBitwiseStructs();
+	std::cout << "=============" << std::endl;
+	TestContainers();
+	std::cout << "=============" << std::endl;
+	TestColumnar();
+	std::cout << "=============" << std::endl;
+	TestSkipPeek();
+	std::cout << "=============" << std::endl;
+	TestPmr();
+	std::cout << "=============" << std::endl;
+	TestAllocator();
+	std::cout << "=============" << std::endl;
+	TestOstreamPool();
+	std::cout << "=============" << std::endl;
+	TestSizeStream();
+	std::cout << "=============" << std::endl;
+	TestWriteAll();
+	std::cout << "=============" << std::endl;
+	TestReadWindow();
+	std::cout << "=============" << std::endl;
+	TestStreamCore();
+	std::cout << "=============" << std::endl;
+	TestPtrOstream();
+	std::cout << "=============" << std::endl;
+	TestSmallOstream();
+	std::cout << "=============" << std::endl;
+	TestRopeOstream();
+	std::cout << "=============" << std::endl;
+	TestSegmented();
+	std::cout << "=============" << std::endl;
+	TestSharedBuffer();
+	std::cout << "=============" << std::endl;
+	TestPositional();
+	std::cout << "=============" << std::endl;
+	TestLargeFile();
+	std::cout << "=============" << std::endl;
+	TestFileHints();
+	std::cout << "=============" << std::endl;
+	TestDirectIO();
+	std::cout << "=============" << std::endl;
+	TestPrefetch();
+	std::cout << "=============" << std::endl;
+	TestCorruptLength();
+	std::cout << "=============" << std::endl;
 	/*
 	TestMem();
 	std::cout << "=============" << std::endl;
@@ -248,3 +328,1193 @@ void TestMemFileCustomOperators()
 	in >> product;
 	print_product(product);
 }
+
+void TestChunk()
+{
+	simple::mem_ostream<std::true_type> out;
+	out << Product("Book", 10.0f, 50);
+	out << Product("Phone", 25.0f, 20);
+	out << Product("Pillow", 8.0f, 10);
+	const std::vector<char>& vec = out.get_internal_vec();
+
+	// feed the data 5 bytes at a time, as if it came from a socket
+	simple::chunk_istream<std::true_type> in;
+	Product product;
+	for (size_t i = 0; i < vec.size(); i += 5)
+	{
+		in.feed(&vec[i], std::min<size_t>(5, vec.size() - i));
+		while (true)
+		{
+			in.begin();
+			in >> product.product_name >> product.price >> product.qty;
+			if (!in.commit())
+				break;
+			print_product(product);
+		}
+	}
+
+	// a long record fed in small pieces is only decoded again once it is complete
+	simple::mem_ostream<std::true_type> big;
+	big << std::string(100000, 'x') << 7;
+	const std::vector<char>& big_vec = big.get_internal_vec();
+	std::string text;
+	int num = 0, attempts = 0;
+	for (size_t i = 0; i < big_vec.size(); i += 100)
+	{
+		in.feed(&big_vec[i], std::min<size_t>(100, big_vec.size() - i));
+		in.begin();
+		if (!in.need_more())
+			++attempts;
+		in >> text >> num;
+		if (in.commit())
+			cout << text.size() << "," << num << "," << attempts << endl;
+	}
+
+	// a huge element count with a few bytes behind it allocates for the bytes
+	simple::mem_ostream<std::true_type> huge;
+	huge << 400000000 << 1 << 2;
+	std::vector<int> numbers;
+	std::deque<int> queue;
+	in.close();
+	in.feed(huge.data(), huge.size());
+	in.begin();
+	in >> numbers;
+	cout << in.commit() << "," << (numbers.capacity() <= simple::detail::read_step) << ",";
+	in.begin();
+	in >> queue;
+	cout << in.commit() << "," << (queue.size() <= 3) << endl;
+}
+
+void TestUringFile()
+{
+#ifdef SIMPLE_BINSTREAM_POSIX
+	// small blocks, so that values straddle block boundaries
+	simple::uring_file_ostream<std::true_type> out("file6.bin", 4096, 4);
+	for (int i = 0; i < 10000; ++i)
+		out << i << "Hello world!";
+	out.close();
+
+	simple::uring_file_istream<std::true_type> in("file6.bin", 4096, 4);
+	long long sum = 0;
+	int num = 0;
+	std::string str;
+	while (!in.eof())
+	{
+		in >> num >> str;
+		sum += num;
+	}
+	cout << sum << "," << str << endl;
+
+	// the core's skip and peek work on the blocks too
+	in.seekg(0);
+	in.skip<int>();
+	in.skip_string();
+	cout << in.peek<int>() << ",";
+	in >> num;
+	cout << num << "," << in.tellg() << endl;
+
+	// a queue depth of 0 is raised to 2
+	simple::uring_file_ostream<std::true_type> shallow("file6.bin", 4096, 0);
+	for (int i = 0; i < 10000; ++i)
+		shallow << i;
+	bool ok = shallow.close();
+	simple::uring_file_istream<std::true_type> shallow_in("file6.bin", 4096, 0);
+	shallow_in.seekg(9999 * 4);
+	shallow_in >> num;
+	cout << ok << "," << num << endl;
+
+	// the failed write of the last block is reported by close()
+	simple::uring_file_ostream<std::true_type> full("/dev/full", 4096, 2);
+	if (full.is_open())
+	{
+		full << 1 << "Hello world!";
+		cout << "closed:" << full.close() << endl;
+	}
+
+	// writes to a file which failed to open are dropped
+	simple::uring_file_ostream<std::true_type> missing("no_such_dir/file6.bin", 4096, 2);
+	missing << 1 << "Hello world!";
+	cout << "open:" << missing.is_open() << endl;
+#endif
+}
+
+void TestAsyncFlush()
+{
+	simple::file_ostream<std::true_type> out("file7.bin");
+	out.enable_async_flush(64, 2);
+	for (int i = 0; i < 100; ++i)
+		out << i << "Hello world!";
+	std::future<bool> closed = out.close();
+	cout << "file_ostream closed:" << closed.get() << endl;
+
+	// a file which failed to open is never handed to the writer thread
+	simple::file_ostream<std::true_type> missing("no_such_dir/file7.bin");
+	missing.enable_async_flush(64, 2);
+	for (int i = 0; i < 100; ++i)
+		missing << i << "Hello world!";
+	cout << "missing flushed:" << missing.flush().get() << ",closed:" << missing.close().get() << endl;
+
+	simple::memfile_ostream<std::true_type> mem_out;
+	mem_out << 23 << 24 << "Hello world!";
+	std::future<bool> written = mem_out.write_to_file_async("file8.bin");
+	mem_out << 25;
+	cout << "memfile_ostream written:" << written.get() << endl;
+
+	simple::file_istream<std::true_type> in("file7.bin");
+	long long sum = 0;
+	int num = 0;
+	std::string str;
+	while (!in.eof())
+	{
+		in >> num >> str;
+		sum += num;
+	}
+	cout << sum << "," << str << endl;
+
+	simple::memfile_istream<std::true_type> mem_in("file8.bin");
+	int num1 = 0, num2 = 0;
+	mem_in >> num1 >> num2 >> str;
+	cout << num1 << "," << num2 << "," << str << endl;
+}
+
+struct Point
+{
+	int x;
+	int y;
+	float z;
+
+	SIMPLE_BINSTREAM_FIELDS(x, y, z)
+};
+
+// listed out of memory order, so never copied as a block
+struct Reversed
+{
+	int a;
+	int b;
+
+	SIMPLE_BINSTREAM_FIELDS(b, a)
+};
+
+void TestBitwiseStructs()
+{
+	static_assert(simple::is_bitwise_serializable<Point>::value, "Point should be copied as a block");
+	static_assert(!simple::is_bitwise_serializable<Product>::value, "Product has a string");
+
+	Point src[3] = { { 1, 2, 3.0f }, { 4, 5, 6.0f }, { 7, 8, 9.0f } };
+	simple::mem_ostream<std::true_type> out;
+	simple::write_array(out, src, 3);
+	out << src[0];
+
+	simple::ptr_istream<std::true_type> in(out.get_internal_vec());
+	Point dest[3];
+	simple::read_array(in, dest, 3);
+	Point single;
+	in >> single;
+
+	for (size_t i = 0; i < 3; ++i)
+		cout << dest[i].x << "," << dest[i].y << "," << dest[i].z << endl;
+	cout << single.x << "," << single.y << "," << single.z << endl;
+
+	// swapped endian goes field by field
+	simple::mem_ostream<std::false_type> swapped_out;
+	simple::write_array(swapped_out, src, 3);
+	simple::mem_istream<std::false_type> swapped_in(swapped_out.get_internal_vec());
+	simple::read_array(swapped_in, dest, 3);
+	cout << dest[2].x << "," << dest[2].y << "," << dest[2].z << endl;
+
+	// the fields are written in the order listed, whatever the byte order
+	Reversed rev[2] = { { 1, 2 }, { 3, 4 } };
+	simple::mem_ostream<std::true_type> rev_out;
+	rev_out << rev[0];
+	simple::write_array(rev_out, rev, 2);
+	simple::mem_istream<std::true_type> rev_in(rev_out.get_internal_vec());
+	int first = 0, second = 0;
+	rev_in >> first >> second;
+	Reversed rev_dest[2];
+	simple::read_array(rev_in, rev_dest, 2);
+	cout << first << "," << second << "," << rev_dest[1].a << "," << rev_dest[1].b << endl;
+}
+
+void TestContainers()
+{
+	std::map<std::string, std::vector<int> > scores;
+	scores["Jack"] = { 1, 2, 3 };
+	scores["Jill"] = { 4, 5 };
+	std::unordered_map<int, std::string> names = { { 1, "one" }, { 2, "two" } };
+	std::array<Point, 2> points = { { { 1, 2, 3.0f }, { 4, 5, 6.0f } } };
+	std::set<std::string> tags = { "b", "a" };
+	std::tuple<int, std::string, std::pair<float, bool> > misc(7, "seven", std::make_pair(7.5f, true));
+	std::vector<Product> products = { Product("Apples", 2.5f, 5), Product("Soap", 30.25f, 250) };
+
+	simple::mem_ostream<std::true_type> out;
+	out << scores << names << points << tags << misc << products;
+
+	std::map<std::string, std::vector<int> > scores2;
+	std::unordered_map<int, std::string> names2;
+	std::array<Point, 2> points2;
+	std::set<std::string> tags2;
+	std::tuple<int, std::string, std::pair<float, bool> > misc2;
+	std::vector<Product> products2;
+	simple::ptr_istream<std::true_type> in(out.get_internal_vec());
+	in >> scores2 >> names2 >> points2 >> tags2 >> misc2 >> products2;
+
+	for (std::map<std::string, std::vector<int> >::const_iterator it = scores2.begin(); it != scores2.end(); ++it)
+		cout << it->first << ":" << it->second.size() << ",";
+	cout << names2[1] << "," << names2[2] << "," << points2[1].x << "," << *tags2.begin() << endl;
+	cout << std::get<0>(misc2) << "," << std::get<1>(misc2) << "," << std::get<2>(misc2).first << endl;
+	print_products(products2);
+
+#ifdef SIMPLE_BINSTREAM_CPP17
+	std::optional<int> opt = 42, none;
+	std::variant<int, std::string> var = std::string("variant");
+	simple::mem_ostream<std::false_type> opt_out;
+	opt_out << opt << none << var;
+
+	std::optional<int> opt2, none2 = 1;
+	std::variant<int, std::string> var2;
+	simple::mem_istream<std::false_type> opt_in(opt_out.get_internal_vec());
+	opt_in >> opt2 >> none2 >> var2;
+	cout << *opt2 << "," << none2.has_value() << "," << std::get<1>(var2) << endl;
+#endif
+}
+
+void TestColumnar()
+{
+	std::vector<Product> vec;
+	vec.push_back(Product("Book", 10.0f, 50));
+	vec.push_back(Product("Phone", 25.0f, 20));
+	vec.push_back(Product("Pillow", 8.0f, 10));
+
+	simple::file_ostream<std::true_type> out("file9.bin");
+	simple::write_columnar(out, vec);
+	simple::write_columnar(out, vec);
+	out.flush();
+	out.close();
+
+	simple::file_istream<std::true_type> in("file9.bin");
+	std::vector<Product> all;
+	simple::read_columnar(in, all);
+	print_products(all);
+
+	// only the qty column is decoded, the names and prices are skipped
+	std::vector<Product> qty_only;
+	simple::read_columnar(in, qty_only, simple::column_bit(2));
+	int total = 0;
+	for (size_t i = 0; i < qty_only.size(); ++i)
+		total += qty_only[i].qty;
+	cout << "Total qty:" << total << ", name:\"" << qty_only[0].product_name << "\"" << endl;
+
+	simple::mem_ostream<std::false_type> swapped_out;
+	simple::write_columnar(swapped_out, vec);
+	simple::ptr_istream<std::false_type> swapped_in(swapped_out.get_internal_vec());
+	simple::read_columnar(swapped_in, all, simple::column_bit(0) | simple::column_bit(1));
+	print_products(all);
+}
+
+void TestSkipPeek()
+{
+	simple::file_ostream<std::true_type> out("file10.bin");
+	out << "Book" << 10.0f << 50 << "Phone" << 25.0f << 20;
+	out.flush();
+	out.close();
+
+	simple::file_istream<std::true_type> in("file10.bin");
+	int total = 0;
+	while (!in.eof())
+	{
+		in.skip_string();
+		in.skip<float>();
+		int qty = in.peek<int>();
+		int same = 0;
+		in >> same;
+		cout << qty << "," << same << ",";
+		total += qty;
+	}
+	cout << "Total qty:" << total << endl;
+
+	// a peeked value is still ahead of the stream for tellg() and seekg()
+	in.seekg(0);
+	int len = in.peek<int>();
+	int64_t pos = in.tellg();
+	in.seekg(sizeof(int) + len, SEEK_CUR);
+	float price = 0.0f;
+	in >> price;
+	cout << len << "," << pos << "," << price << endl;
+}
+
+void TestPmr()
+{
+#ifdef SIMPLE_BINSTREAM_PMR
+	std::vector<std::string> names = { "A name too long for the small string buffer", "Another name too long for the small string" };
+	std::map<std::string, int> counts = { { "A key too long for the small string buffer", 1 } };
+	simple::mem_ostream<std::true_type> out;
+	out << names << counts;
+
+	char buffer[4096];
+	std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+	std::pmr::vector<std::pmr::string> pmr_names(&arena);
+	std::pmr::map<std::pmr::string, int> pmr_counts(&arena);
+
+	// every allocation must come from the arena, the default resource would throw
+	std::pmr::memory_resource* old_default = std::pmr::set_default_resource(std::pmr::null_memory_resource());
+	simple::ptr_istream<std::true_type> in(out.get_internal_vec());
+	in >> pmr_names >> pmr_counts;
+	std::pmr::set_default_resource(old_default);
+
+	cout << pmr_names[1] << "," << pmr_counts.begin()->first << "," << pmr_counts.begin()->second << endl;
+#endif
+}
+
+void TestAllocator()
+{
+#ifdef SIMPLE_BINSTREAM_PMR
+	typedef std::pmr::polymorphic_allocator<char> pmr_allocator;
+	char buffer[4096];
+	std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+
+	simple::mem_ostream<std::true_type, pmr_allocator> out(&arena);
+	out << 23 << 24 << "Hello world!";
+	bool in_arena = out.data() >= buffer && out.data() < buffer + sizeof(buffer);
+
+	simple::mem_istream<std::true_type, pmr_allocator> in(out.get_internal_vec(), &arena);
+	int num1 = 0, num2 = 0;
+	std::string str;
+	in >> num1 >> num2 >> str;
+	cout << num1 << "," << num2 << "," << str << "," << in_arena << endl;
+
+	simple::memfile_ostream<std::true_type, pmr_allocator> file_out(&arena);
+	file_out << 25 << "Hello file!";
+	bool ok = file_out.write_to_file_async("file11.bin").get();
+	simple::memfile_istream<std::true_type> file_in("file11.bin");
+	file_in >> num1 >> str;
+	cout << num1 << "," << str << "," << ok << endl;
+#endif
+}
+
+void TestOstreamPool()
+{
+	simple::mem_ostream_pool<std::true_type> pool;
+	const unsigned ORDER = 1;
+	size_t regrown = 0;
+	for (int i = 0; i < 100; ++i)
+	{
+		simple::mem_ostream_pool<std::true_type>::pointer out = pool.acquire(ORDER);
+		size_t capacity = out->capacity();
+		// every 50th message is an outlier
+		int count = (i % 50 == 49) ? 10000 : 100 + i % 10;
+		for (int n = 0; n < count; ++n)
+			*out << n;
+		if (i >= 20 && count < 10000 && out->capacity() != capacity)
+			++regrown;
+	}
+	simple::mem_ostream_pool<std::true_type>::pointer out = pool.acquire(ORDER);
+	cout << "Predicted:" << pool.predicted_size(ORDER) << ", regrown:" << regrown << ", capacity:" << out->capacity() << endl;
+}
+
+void TestSizeStream()
+{
+	static_assert(simple::serialized_size<Point>() == 12, "Point has a fixed size");
+	static_assert(simple::serialized_size<std::pair<int, double> >() == 12, "pair of numbers has a fixed size");
+	static_assert(!simple::has_fixed_size<Product>::value, "Product has a string");
+
+	std::vector<Product> vec;
+	vec.push_back(Product("Book", 10.0f, 50));
+	vec.push_back(Product("Phone", 25.0f, 20));
+
+	simple::size_ostream<> sizer;
+	sizer << vec << "Hello world!" << 23;
+
+	simple::mem_ostream<std::true_type> out;
+	out.reserve(sizer.size());
+	out << vec << "Hello world!" << 23;
+	cout << sizer.size() << "," << out.size() << "," << out.capacity() << "," << simple::serialized_size(vec[0]) << endl;
+}
+
+void TestWriteAll()
+{
+	using same_endian_type = std::is_same<simple::LittleEndian, simple::BigEndian>;
+	simple::mem_ostream<same_endian_type> out;
+	std::string name = "Book";
+	simple::write_all(out, name, 10.0f, 50);
+	simple::write_all(out, "Phone", 25.0f, 20, std::vector<int>(2, 7));
+
+	simple::mem_ostream<same_endian_type> chained;
+	chained << name << 10.0f << 50 << "Phone" << 25.0f << 20 << std::vector<int>(2, 7);
+
+	simple::ptr_istream<same_endian_type> in(out.get_internal_vec());
+	Product product;
+	in >> product.product_name >> product.price >> product.qty;
+	print_product(product);
+	cout << (out.get_internal_vec() == chained.get_internal_vec()) << endl;
+}
+
+void TestReadWindow()
+{
+	simple::mem_ostream<std::true_type> out;
+	for (int i = 0; i < 3; ++i)
+		out << i << (float)i * 1.5f << (int64_t)i * 100;
+	out << 7;
+
+	// one bounds check per record
+	simple::mem_istream<std::true_type> in(out.get_internal_vec());
+	int num = 0;
+	float price = 0.0f;
+	int64_t id = 0;
+	for (int i = 0; i < 3; ++i)
+	{
+		in.ensure(sizeof(int) + sizeof(float) + sizeof(int64_t));
+		in.read_unchecked(num);
+		in.read_unchecked(price);
+		in.read_unchecked(id);
+		cout << num << "," << price << "," << id << ",";
+	}
+	cout << endl;
+
+	// padded buffer: read the record first, check it afterwards
+	std::vector<char> padded(out.get_internal_vec());
+	padded.resize(padded.size() + 16);
+	simple::ptr_istream<std::true_type> padded_in(padded.data(), out.size(), 16);
+	try
+	{
+		while (!padded_in.eof())
+		{
+			padded_in.read_unchecked(num);
+			padded_in.read_unchecked(price);
+			padded_in.read_unchecked(id);
+			padded_in.check();
+			cout << num << ",";
+		}
+	}
+	catch (std::runtime_error& e)
+	{
+		cout << e.what() << endl;
+	}
+}
+
+// A sink and a source of its own get every operator of the other streams.
+struct string_sink
+{
+	std::string str;
+protected:
+	void put(const char* p, size_t size)
+	{
+		str.append(p, size);
+	}
+};
+
+struct string_source
+{
+	string_source() : pos(0) {}
+	explicit string_source(const std::string& s) : str(s), pos(0) {}
+	bool eof() const
+	{
+		return pos >= str.size();
+	}
+	size_t tellg() const
+	{
+		return pos;
+	}
+protected:
+	bool fetch(char* p, size_t size)
+	{
+		if (!look(p, size))
+			return false;
+		pos += size;
+		return true;
+	}
+	bool discard(size_t size)
+	{
+		if (pos + size > str.size())
+			return false;
+		pos += size;
+		return true;
+	}
+	bool look(char* p, size_t size) const
+	{
+		if (pos + size > str.size())
+			return false;
+		std::memcpy(p, str.data() + pos, size);
+		return true;
+	}
+	void fail() const
+	{
+		throw std::runtime_error("End of string!");
+	}
+	std::string str;
+	size_t pos;
+};
+
+void TestStreamCore()
+{
+	std::vector<Product> vec;
+	vec.push_back(Product("Book", 10.0f, 50));
+	vec.push_back(Product("Phone", 25.0f, 20));
+
+	simple::basic_bin_ostream<string_sink, std::true_type> out;
+	out << vec << "end";
+
+	simple::mem_ostream<std::true_type> mem;
+	mem << vec << "end";
+	std::cout << (out.str.size() == mem.size() && out.str == std::string(mem.data(), mem.size()) ? "same bytes" : "different bytes") << std::endl;
+
+	simple::basic_bin_istream<string_source, std::true_type> in(out.str);
+	std::vector<Product> vec2;
+	std::string end;
+	in >> vec2;
+	std::cout << in.peek<int>() << std::endl;
+	// a copy goes through the copy constructor, not the forwarding one
+	simple::basic_bin_istream<string_source, std::true_type> copy(in);
+	in >> end;
+	print_products(vec2);
+	std::cout << end << "," << in.eof() << std::endl;
+	copy >> end;
+	std::cout << end << "," << copy.eof() << std::endl;
+	static_assert(!std::is_copy_constructible<simple::segmented_istream<std::true_type> >::value, "segments point into the stream");
+	simple::mem_istream<std::true_type> from_vec = mem.get_internal_vec();
+	from_vec >> vec2;
+	std::cout << vec2.size() << std::endl;
+
+	try
+	{
+		int n = 0;
+		in >> n;
+	}
+	catch (std::runtime_error& e)
+	{
+		std::cout << e.what() << std::endl;
+	}
+}
+
+void TestPtrOstream()
+{
+	// encoded on the stack
+	char buf[32];
+	simple::ptr_ostream<std::true_type> out(buf, sizeof(buf));
+	out << 0 << std::string("Book") << 10.0f;
+	out.writeat(0, (int)out.size());
+	std::cout << out.size() << "/" << out.capacity() << std::endl;
+
+	simple::ptr_istream<std::true_type> in(out.data(), out.size());
+	int size = 0;
+	std::string name;
+	float price = 0.0f;
+	in >> size >> name >> price;
+	std::cout << size << "," << name << "," << price << std::endl;
+
+	try
+	{
+		simple::write_all(out, 1, std::string("a name which does not fit"));
+	}
+	catch (std::runtime_error& e)
+	{
+		std::cout << e.what() << std::endl;
+	}
+	// the record was written in one go, so nothing of it was written
+	std::cout << out.size() << std::endl;
+
+	try
+	{
+		out.writeat(out.size() - 2, 1);
+	}
+	catch (std::runtime_error& e)
+	{
+		std::cout << e.what() << std::endl;
+	}
+}
+
+void TestSmallOstream()
+{
+	simple::small_mem_ostream<std::true_type, 32> out;
+	out << 1 << std::string("Book") << 10.0f;
+	std::cout << out.size() << "," << out.is_inline() << std::endl;
+
+	// outgrows the inline storage
+	out << std::string("a name which does not fit inline");
+	std::cout << out.size() << "," << out.is_inline() << std::endl;
+	out.writeat(0, 2);
+
+	simple::small_mem_ostream<std::true_type, 32> moved(std::move(out));
+	simple::small_mem_ostream<std::true_type, 32> copy;
+	copy = moved;
+
+	simple::const_span bytes = copy.span();
+	simple::ptr_istream<std::true_type> in(bytes.data(), bytes.size());
+	int num = 0;
+	std::string name, name2;
+	float price = 0.0f;
+	in >> num >> name >> price >> name2;
+	std::cout << num << "," << name << "," << price << "," << name2 << std::endl;
+	std::cout << out.size() << "," << moved.size() << "," << copy.is_inline() << std::endl;
+}
+
+void TestRopeOstream()
+{
+	// small blocks, so that values and strings straddle them
+	simple::rope_ostream<std::true_type> out(16);
+	simple::mem_ostream<std::true_type> mem;
+	out << 0 << std::string("Product name") << 3.5f;
+	mem << 0 << std::string("Product name") << 3.5f;
+	for (int i = 0; i < 10; ++i)
+	{
+		out << i;
+		mem << i;
+	}
+	// the int at 14 spans the first two blocks
+	out.writeat(14, 12345);
+	mem.writeat(14, 12345);
+	std::cout << out.size() << "," << out.block_count() << std::endl;
+
+	std::string joined;
+	for (size_t i = 0; i < out.block_count(); ++i)
+		joined.append(out.block(i).data(), out.block(i).size());
+	std::cout << (joined == std::string(mem.data(), mem.size()) ? "same bytes" : "different bytes") << std::endl;
+
+	bool ok = out.write_to_file("file9.bin");
+	simple::memfile_istream<std::true_type> in("file9.bin");
+	std::cout << ok << "," << in.file_length() << std::endl;
+	int first = 0;
+	in >> first;
+	in.seekg(14);
+	int patched = 0;
+	in >> patched;
+	std::cout << first << "," << patched << std::endl;
+
+	// the blocks are reused after clear()
+	out.clear();
+	out << 1;
+	std::cout << out.size() << "," << out.block_count() << std::endl;
+}
+
+void TestSegmented()
+{
+	std::vector<Product> vec;
+	vec.push_back(Product("Book", 10.0f, 50));
+	vec.push_back(Product("Phone", 25.0f, 20));
+	vec.push_back(Product("Laptop", 125.0f, 5));
+
+	// the blocks of a rope, which cut through values
+	simple::rope_ostream<std::true_type> out(8);
+	out << vec << 99;
+
+	simple::segmented_istream<std::true_type> in;
+	for (size_t i = 0; i < out.block_count(); ++i)
+		in.add(out.block(i).data(), out.block(i).size());
+	std::cout << in.segment_count() << "," << in.size() << std::endl;
+
+	std::vector<Product> vec2;
+	in >> vec2;
+	print_products(vec2);
+	std::cout << in.peek<int>() << ",";
+	int last = 0;
+	in >> last;
+	std::cout << last << "," << in.eof() << std::endl;
+
+	// a file split into two parts in the middle of a string
+	simple::mem_ostream<std::true_type> mem;
+	mem << vec;
+	std::FILE* fp = std::fopen("file9.bin", "wb");
+	std::fwrite(mem.data(), 10, 1, fp);
+	std::fclose(fp);
+	fp = std::fopen("file10.bin", "wb");
+	std::fwrite(mem.data() + 10, mem.size() - 10, 1, fp);
+	std::fclose(fp);
+
+	simple::segmented_istream<std::true_type> parts;
+	bool ok = parts.add_file("file9.bin") && parts.add_file("file10.bin");
+	std::cout << ok << "," << parts.size() << std::endl;
+	parts.seekg(4);
+	parts.skip_string();
+	float price = 0.0f;
+	parts >> price;
+	std::cout << price << std::endl;
+
+	try
+	{
+		parts.seekg(parts.size() - 2);
+		parts >> last;
+	}
+	catch (std::runtime_error& e)
+	{
+		std::cout << e.what() << std::endl;
+	}
+}
+
+void TestSharedBuffer()
+{
+	// 4 regions of 1000 records of 16 bytes
+	simple::file_ostream<std::true_type> out("file9.bin");
+	for (int i = 0; i < 4000; ++i)
+		out << i << (float)i << (int64_t)i;
+	out.flush().get();
+	out.close().get();
+
+	simple::shared_buffer buf = simple::shared_buffer::load("file9.bin");
+	std::cout << buf.size() << "," << buf.padding() << std::endl;
+
+	// each thread decodes its slice with a stream of its own
+	std::vector<std::future<int64_t> > sums;
+	for (size_t t = 0; t < 4; ++t)
+	{
+		simple::shared_buffer slice = buf.slice(t * 16000, 16000);
+		sums.push_back(std::async(std::launch::async, [slice]() {
+			simple::shared_istream<std::true_type> in(slice);
+			int64_t sum = 0;
+			int num = 0;
+			float price = 0.0f;
+			int64_t id = 0;
+			while (!in.eof())
+			{
+				in >> num >> price >> id;
+				sum += id;
+			}
+			return sum;
+		}));
+	}
+	int64_t sum = 0;
+	for (size_t t = 0; t < sums.size(); ++t)
+		sum += sums[t].get();
+	std::cout << sum << std::endl;
+
+	// a copy is a cursor of its own
+	simple::shared_istream<std::true_type> in(buf.slice(16, 32));
+	int num = 0;
+	in >> num;
+	simple::shared_istream<std::true_type> clone(in);
+	int num2 = 0;
+	clone.skip(12);
+	clone >> num2;
+	float price = 0.0f;
+	in >> price;
+	std::cout << num << "," << price << "," << num2 << "," << in.buffer().use_count() << std::endl;
+
+	try
+	{
+		buf.slice(buf.size() - 8, 16);
+	}
+	catch (std::runtime_error& e)
+	{
+		std::cout << e.what() << std::endl;
+	}
+}
+
+void TestPositional()
+{
+	// 1000 records of 16 bytes
+	simple::file_ostream<std::true_type> out("file10.bin");
+	for (int i = 0; i < 1000; ++i)
+		out << i << (float)i * 0.5f << (int64_t)i * 3;
+	out.close().get();
+
+	simple::positional_file file("file10.bin");
+	std::cout << file.is_open() << "," << file.size() << std::endl;
+
+	// random lookups from 4 threads on the one open file
+	std::vector<std::future<int> > bad;
+	for (int t = 0; t < 4; ++t)
+	{
+		bad.push_back(std::async(std::launch::async, [&file, t]() {
+			simple::positional_istream<std::true_type> in(file, 0, 16);
+			int errors = 0;
+			for (int k = 0; k < 1000; ++k)
+			{
+				int rec = (k * 7 + t * 13) % 1000;
+				in.seekg((uint64_t)rec * 16);
+				int num = 0;
+				float price = 0.0f;
+				int64_t id = 0;
+				in >> num >> price >> id;
+				if (num != rec || price != (float)rec * 0.5f || id != (int64_t)rec * 3)
+					++errors;
+			}
+			return errors;
+		}));
+	}
+	int errors = 0;
+	for (size_t t = 0; t < bad.size(); ++t)
+		errors += bad[t].get();
+	std::cout << errors << std::endl;
+
+	// a sequential scan through the default buffer
+	simple::positional_istream<std::true_type> in(file);
+	int64_t sum = 0;
+	while (!in.eof())
+	{
+		int num = 0;
+		in.skip<int>();
+		in.skip<float>();
+		in >> num;
+		in.skip<int>();
+		sum += num;
+	}
+	std::cout << sum << std::endl;
+
+	try
+	{
+		in.seekg(file.size() - 2);
+		int num = 0;
+		in >> num;
+	}
+	catch (std::runtime_error& e)
+	{
+		std::cout << e.what() << std::endl;
+	}
+}
+
+void TestLargeFile()
+{
+	// a sparse file of 5 GB, with records at the start and past 4 GB
+	const int64_t far = ((int64_t)5 << 30);
+	simple::file_ostream<std::true_type> out("file11.bin");
+	out << 1 << 2;
+	out.close().get();
+	std::FILE* fp = std::fopen("file11.bin", "r+b");
+	simple::detail::fseek64(fp, far, SEEK_SET);
+	simple::mem_ostream<std::true_type> tail;
+	tail << 3 << (int64_t)far;
+	std::fwrite(tail.data(), tail.size(), 1, fp);
+	std::fclose(fp);
+
+	simple::file_istream<std::true_type> in("file11.bin");
+	std::cout << (in.file_length() == far + 12) << std::endl;
+	int num = 0;
+	in >> num;
+	in.skip((size_t)(far - 4));
+	std::cout << (in.tellg() == far) << "," << in.peek<int>() << std::endl;
+	int64_t offset = 0;
+	in >> num >> offset;
+	std::cout << num << "," << (offset == far) << "," << in.eof() << std::endl;
+	in.seekg(far + 4);
+	in >> offset;
+	std::cout << (offset == far) << std::endl;
+
+	simple::positional_file file("file11.bin");
+	simple::positional_istream<std::true_type> cursor(file, (uint64_t)far);
+	cursor >> num;
+	std::cout << (file.size() == (uint64_t)far + 12) << "," << num << std::endl;
+
+	in.close();
+	file.close();
+	std::remove("file11.bin");
+}
+
+void TestFileHints()
+{
+	// more than a writeback_chunk, written back and dropped as it goes
+	const int count = (int)(simple::writeback_chunk / 16) + 1000;
+	simple::file_ostream<std::true_type> out("file10.bin", simple::hint_writeback | simple::hint_dontneed | simple::hint_noreuse);
+	for (int i = 0; i < count; ++i)
+		out << i << (float)i << (int64_t)i;
+	bool ok = out.close().get();
+
+	// a one-off scan
+	simple::file_istream<std::true_type> in("file10.bin", simple::hint_sequential | simple::hint_willneed | simple::hint_dontneed);
+	int errors = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		int num = 0;
+		float price = 0.0f;
+		int64_t id = 0;
+		in >> num >> price >> id;
+		if (num != i || id != i)
+			++errors;
+	}
+	std::cout << ok << "," << in.eof() << "," << errors << std::endl;
+	in.close();
+
+	simple::memfile_istream<std::true_type> mem("file10.bin", simple::hint_sequential | simple::hint_dontneed);
+	int num = 0;
+	mem.seekg((size_t)(count - 1) * 16);
+	mem >> num;
+	std::cout << (mem.file_length() == (int64_t)count * 16) << "," << (num == count - 1) << std::endl;
+}
+
+void TestDirectIO()
+{
+#ifdef SIMPLE_BINSTREAM_POSIX
+	// falls back to cached I/O where O_DIRECT is not supported, so is_direct() is not printed
+	const int count = 50000;
+	simple::uring_file_ostream<std::true_type> out("file10.bin", 1 << 16, 4, simple::hint_direct);
+	for (int i = 0; i < count / 2; ++i)
+		out << i << (int16_t)i;
+	out.flush();
+	for (int i = count / 2; i < count; ++i)
+		out << i << (int16_t)i;
+	out << "tail";
+	out.close();
+
+	// 6 bytes per value, so the file does not end on an aligned size
+	simple::file_istream<std::true_type> check("file10.bin");
+	std::cout << (check.file_length() == (int64_t)count * 6 + 8) << std::endl;
+	check.close();
+
+	simple::uring_file_istream<std::true_type> in("file10.bin", 1 << 16, 4, simple::hint_direct);
+	int errors = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		int num = 0;
+		int16_t small = 0;
+		in >> num >> small;
+		if (num != i || small != (int16_t)i)
+			++errors;
+	}
+	std::string str;
+	in >> str;
+	std::cout << errors << "," << str << "," << in.eof() << std::endl;
+#endif
+}
+
+void TestPrefetch()
+{
+	const int count = 100000;
+	simple::file_ostream<std::true_type> out("file10.bin");
+	for (int i = 0; i < count; ++i)
+		out << i << (int16_t)i << (int8_t)i;
+	out << "Hello world!";
+	out.close();
+
+	// small blocks, so that values straddle blocks and the thread waits for the reader
+	simple::prefetch_istream<std::true_type> in("file10.bin", 4093, 3);
+	int errors = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		int num = 0;
+		int16_t small = 0;
+		int8_t tiny = 0;
+		// a peek also straddles blocks
+		if (in.peek<int>() != i)
+			++errors;
+		in >> num >> small >> tiny;
+		if (num != i || small != (int16_t)i || tiny != (int8_t)i)
+			++errors;
+	}
+	std::string str;
+	in >> str;
+	std::cout << errors << "," << str << "," << in.eof() << std::endl;
+
+	// back inside the file, then a skip longer than the ring
+	int num = 0;
+	in.seekg(7 * 10);
+	in >> num;
+	in.skip(7 * 5000 - 4);
+	int after = 0;
+	in >> after;
+	std::cout << num << "," << after << "," << (in.tellg() == 7 * 5010 + 4) << std::endl;
+
+	try
+	{
+		in.seekg(in.file_length() - 2);
+		in >> num;
+	}
+	catch (std::runtime_error& e)
+	{
+		std::cout << e.what() << std::endl;
+	}
+	in.close();
+
+	// a peek longer than the ring is read from the file
+	simple::prefetch_istream<std::true_type> narrow("file10.bin", 16, 2);
+	int first = 0;
+	narrow >> first;
+	std::array<int, 70> ahead = narrow.peek<std::array<int, 70> >();
+	int64_t pos = narrow.tellg();
+	std::array<int, 70> read_back;
+	for (size_t i = 0; i < read_back.size(); ++i)
+		narrow >> read_back[i];
+	std::cout << first << "," << pos << "," << (ahead == read_back) << "," << narrow.tellg() << std::endl;
+	narrow.close();
+
+	simple::prefetch_istream<std::true_type> missing("no_such_file.bin");
+	std::cout << missing.is_open() << "," << missing.eof() << std::endl;
+}
+
+// a length or count prefix far beyond the data, as in a corrupt file, fails
+// without allocating for it
+void TestCorruptLength()
+{
+	simple::memfile_ostream<std::true_type> out;
+	out << INT_MAX << "Hello world!";
+	// write_to_file() empties the buffer, so the streams copy it first
+	simple::mem_istream<std::true_type> in(out.get_internal_vec());
+	// a source which does not know its size reads what is there
+	simple::basic_bin_istream<string_source, std::true_type> src(std::string(out.data(), out.size()));
+	out.write_to_file("file10.bin");
+
+	// the length prefix is read, so the error comes from checking it
+	std::string str = "old";
+	try
+	{
+		in >> str;
+	}
+	catch (std::runtime_error& e)
+	{
+		std::cout << e.what() << "," << str.empty() << "," << in.tellg() << std::endl;
+	}
+
+	simple::file_istream<std::true_type> file_in("file10.bin");
+	try
+	{
+		file_in.read(str, 1 << 30);
+	}
+	catch (std::runtime_error& e)
+	{
+		std::cout << e.what() << "," << str.empty() << "," << file_in.tellg() << std::endl;
+	}
+
+	str = "old";
+	try
+	{
+		src >> str;
+	}
+	catch (std::runtime_error& e)
+	{
+		std::cout << e.what() << "," << str.empty() << "," << src.tellg() << std::endl;
+	}
+
+	// element counts
+	simple::mem_ostream<std::true_type> counts;
+	counts << INT_MAX << 1 << 2 << 3;
+	std::vector<int> numbers;
+	std::vector<std::string> names;
+	std::unordered_map<int, std::string> table;
+	try
+	{
+		simple::mem_istream<std::true_type> vec_in(counts.get_internal_vec());
+		vec_in >> numbers;
+	}
+	catch (std::runtime_error& e)
+	{
+		std::cout << e.what() << "," << numbers.capacity() << std::endl;
+	}
+	try
+	{
+		simple::mem_istream<std::true_type> names_in(counts.get_internal_vec());
+		names_in >> names;
+	}
+	catch (std::runtime_error& e)
+	{
+		std::cout << e.what() << "," << (names.capacity() < 100) << std::endl;
+	}
+	try
+	{
+		simple::mem_istream<std::true_type> table_in(counts.get_internal_vec());
+		table_in >> table;
+	}
+	catch (std::runtime_error& e)
+	{
+		std::cout << e.what() << "," << (table.bucket_count() < 100) << std::endl;
+	}
+	try
+	{
+		simple::basic_bin_istream<string_source, std::true_type> vec_src(std::string(counts.data(), counts.size()));
+		vec_src >> numbers;
+	}
+	catch (std::runtime_error& e)
+	{
+		std::cout << e.what() << "," << (numbers.capacity() <= simple::detail::read_step) << std::endl;
+	}
+
+	// a columnar batch with a corrupt row count, and one cut short
+	std::vector<Product> vec(3, Product("Book", 10.0f, 50));
+	simple::mem_ostream<std::true_type> batch;
+	simple::write_columnar(batch, vec);
+	std::vector<char> bad = batch.get_internal_vec();
+	int huge = 1 << 30;
+	std::memcpy(bad.data(), &huge, sizeof(huge));
+	std::vector<Product> rows;
+	try
+	{
+		simple::mem_istream<std::true_type> batch_in(bad);
+		simple::read_columnar(batch_in, rows);
+	}
+	catch (std::runtime_error& e)
+	{
+		std::cout << e.what() << "," << rows.size() << std::endl;
+	}
+	std::vector<char> cut(batch.get_internal_vec().begin(), batch.get_internal_vec().end() - 1);
+	try
+	{
+		simple::mem_istream<std::true_type> cut_in(cut);
+		simple::read_columnar(cut_in, rows);
+	}
+	catch (std::runtime_error& e)
+	{
+		std::cout << e.what() << "," << rows.size() << std::endl;
+	}
+	try
+	{
+		simple::basic_bin_istream<string_source, std::true_type> cut_src(std::string(cut.data(), cut.size()));
+		simple::read_columnar(cut_src, rows);
+	}
+	catch (std::runtime_error& e)
+	{
+		std::cout << e.what() << "," << rows.size() << std::endl;
+	}
+	simple::basic_bin_istream<string_source, std::true_type> batch_src(std::string(batch.data(), batch.size()));
+	simple::read_columnar(batch_src, rows);
+	std::cout << rows.size() << "," << rows[2].product_name << "," << rows[2].qty << std::endl;
+}
+
+#ifdef SIMPLE_BINSTREAM_COROUTINE
+// fire-and-forget coroutine type, just enough to drive the test
+struct test_task
+{
+	struct promise_type
+	{
+		test_task get_return_object() { return test_task(); }
+		std::suspend_never initial_suspend() { return std::suspend_never(); }
+		std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+test_task AsyncWriteAndRead(std::promise<void>& done)
+{
+	{
+		simple::async_file_ostream<std::true_type> out("file5.bin", simple::default_async_io_backend(), 16);
+		co_await out.write(23);
+		co_await out.write(24);
+		co_await out.write("Hello world!");
+		co_await out.flush();
+	}
+
+	simple::async_file_istream<std::true_type> in("file5.bin", simple::default_async_io_backend(), 8);
+	int num1 = 0, num2 = 0;
+	std::string str;
+	co_await in.read(num1);
+	co_await in.read(num2);
+	co_await in.read(str);
+
+	cout << num1 << "," << num2 << "," << str << endl;
+
+	// a length prefix far past the end of the file fails the read
+	bool closed = false;
+	{
+		simple::async_file_ostream<std::true_type> out("file5.bin", simple::default_async_io_backend(), 16);
+		co_await out.write(1000000000);
+		co_await out.write(25);
+		closed = out.close();
+	}
+	simple::async_file_istream<std::true_type> bad("file5.bin", simple::default_async_io_backend(), 8);
+	try
+	{
+		co_await bad.read(str);
+	}
+	catch (std::runtime_error& e)
+	{
+		cout << e.what() << "," << closed << endl;
+	}
+	done.set_value();
+}
+
+void TestAsyncFile()
+{
+	std::promise<void> done;
+	AsyncWriteAndRead(done);
+	done.get_future().wait();
+}
+#else
+void TestAsyncFile()
+{
+}
+#endif